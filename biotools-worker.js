@@ -4,6 +4,157 @@
 let toolModule = null;
 let isInitialized = false;
 let currentTool = null;
+let swiftamrIndexHash = null;  // Content hash of the SwiftAMR index kept loaded between runs
+let swiftamrCachedIndexes = new Map();  // Serialized indexes fetched from IndexedDB, by cache key
+let swiftamrCancelFlag = null;  // Int32Array over the page's SharedArrayBuffer for the running alignment
+let swiftamrCancelled = false;  // The engine stopped the current alignment on swiftamrCancelFlag
+
+// IndexedDB store for serialized SwiftAMR indexes, so a page reload loads the
+// prebuilt index instead of rebuilding it
+const SWIFTAMR_INDEX_DB = 'swiftamr-index-cache';
+const SWIFTAMR_INDEX_STORE = 'indexes';
+
+function openIndexCache() {
+    return new Promise((resolve, reject) => {
+        if (typeof indexedDB === 'undefined') {
+            reject(new Error('IndexedDB is not available'));
+            return;
+        }
+        const request = indexedDB.open(SWIFTAMR_INDEX_DB, 1);
+        request.onupgradeneeded = () => request.result.createObjectStore(SWIFTAMR_INDEX_STORE);
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+}
+
+async function readCachedIndex(key) {
+    const db = await openIndexCache();
+    try {
+        return await new Promise((resolve, reject) => {
+            const request = db.transaction(SWIFTAMR_INDEX_STORE, 'readonly').objectStore(SWIFTAMR_INDEX_STORE).get(key);
+            request.onsuccess = () => resolve(request.result || null);
+            request.onerror = () => reject(request.error);
+        });
+    } finally {
+        db.close();
+    }
+}
+
+async function writeCachedIndex(key, bytes) {
+    const db = await openIndexCache();
+    try {
+        await new Promise((resolve, reject) => {
+            const transaction = db.transaction(SWIFTAMR_INDEX_STORE, 'readwrite');
+            transaction.objectStore(SWIFTAMR_INDEX_STORE).put(bytes, key);
+            transaction.oncomplete = () => resolve();
+            transaction.onerror = () => reject(transaction.error);
+        });
+    } finally {
+        db.close();
+    }
+}
+
+// swiftamr.js/swiftamr.wasm are build artifacts (make wasm) and can lag behind
+// the engine sources. A module without the exports every run needs is refused
+// at init, so a stale build fails loudly instead of running a slower path.
+const SWIFTAMR_REQUIRED_EXPORTS = [
+    'swiftamr_build_index', 'swiftamr_cleanup', 'swiftamr_database_hash', 'swiftamr_database_cache_key',
+    'swiftamr_get_hash', 'swiftamr_set_index_storage', 'swiftamr_align_fastq_to_buffer',
+    'swiftamr_output_data', 'swiftamr_output_size', 'swiftamr_output_release', 'malloc', 'free'
+];
+const SWIFTAMR_REQUIRED_RUNTIME = ['ccall', 'cwrap', 'UTF8ToString', 'addFunction', 'HEAPU8', 'HEAPU32'];
+
+// Optional features and the exports each needs. init-complete reports which
+// ones the module has; the page disables the controls of the others.
+const SWIFTAMR_FEATURE_EXPORTS = {
+    pairs: ['swiftamr_align_pairs_to_buffer'],
+    preview: ['swiftamr_set_preview_options'],
+    trace: ['swiftamr_trace_start', 'swiftamr_trace_stop'],
+    progress: ['swiftamr_set_progress_callback'],
+    cancel: ['swiftamr_set_cancel_callback'],
+    counters: ['swiftamr_get_counters']
+};
+let swiftamrFeatures = {};
+
+function swiftamrMissingExports(module) {
+    return SWIFTAMR_REQUIRED_EXPORTS.filter(name => typeof module['_' + name] !== 'function')
+        .map(name => '_' + name)
+        .concat(SWIFTAMR_REQUIRED_RUNTIME.filter(name => !module[name]));
+}
+
+function swiftamrFeatureSet(module) {
+    const features = {};
+    for (const [feature, names] of Object.entries(SWIFTAMR_FEATURE_EXPORTS)) {
+        features[feature] = names.every(name => typeof module['_' + name] === 'function');
+    }
+    return features;
+}
+
+// Back the engine's index storage callbacks with IndexedDB. The engine reads
+// synchronously, so the entry for a database is fetched into
+// swiftamrCachedIndexes before the index is built; writes are copied out and
+// stored in the background.
+function installSwiftAMRIndexStorage(module) {
+    const readIndex = module.addFunction((userData, keyPtr, dataPtrPtr, sizePtr) => {
+        const bytes = swiftamrCachedIndexes.get(module.UTF8ToString(keyPtr));
+        if (!bytes) return -1;
+        const ptr = module._malloc(bytes.length);
+        if (!ptr) return -1;
+        module.HEAPU8.set(bytes, ptr);
+        module.HEAPU32[dataPtrPtr >> 2] = ptr;
+        module.HEAPU32[sizePtr >> 2] = bytes.length;
+        return 0;
+    }, 'iiiii');
+
+    const writeIndex = module.addFunction((userData, keyPtr, dataPtr, size) => {
+        const key = module.UTF8ToString(keyPtr);
+        const bytes = module.HEAPU8.slice(dataPtr, dataPtr + size);
+        writeCachedIndex(key, bytes).then(
+            () => self.postMessage({ type: 'log', text: `Cached k-mer index (${(size / 1024 / 1024).toFixed(2)} MB)` }),
+            (error) => self.postMessage({ type: 'log', text: `Could not cache k-mer index: ${error.message}` })
+        );
+        return 0;
+    }, 'iiiii');
+
+    module.ccall('swiftamr_set_index_storage', null, ['number', 'number'], [readIndex, writeIndex]);
+}
+
+// Forward the engine's progress reports to the page while an alignment call
+// blocks the worker: reads, bytes consumed, reads/sec and an ETA from the
+// byte rate
+function installSwiftAMRProgress(module) {
+    if (!swiftamrFeatures.progress) return;
+    const onProgress = module.addFunction((reads, bytes, totalBytes, readsPerSec, done) => {
+        const fraction = totalBytes > 0 ? bytes / totalBytes : 1;
+        const seconds = readsPerSec > 0 ? reads / readsPerSec : 0;
+        self.postMessage({
+            type: 'progress',
+            reads,
+            bytes,
+            totalBytes,
+            readsPerSec,
+            fraction,
+            etaSeconds: done || fraction <= 0 ? 0 : seconds * (1 - fraction) / fraction,
+            done: !!done
+        });
+    }, 'vddddi');
+
+    module.ccall('swiftamr_set_progress_callback', null, ['number', 'number', 'number'], [onProgress, 0, 0]);
+}
+
+// The alignment call blocks the worker, so a 'cancel' message would only be
+// read after it returns. Instead the engine polls this callback between
+// chunks of reads, and it reads a flag the page sets in shared memory.
+function installSwiftAMRCancel(module) {
+    if (!swiftamrFeatures.cancel) return;
+    const isCancelled = module.addFunction(() => {
+        if (!swiftamrCancelFlag || Atomics.load(swiftamrCancelFlag, 0) === 0) return 0;
+        swiftamrCancelled = true;
+        return 1;
+    }, 'i');
+
+    module.ccall('swiftamr_set_cancel_callback', null, ['number'], [isCancelled]);
+}
 
 // Tool configurations - defines output patterns and behavior for each tool
 const TOOL_CONFIGS = {
@@ -85,6 +236,9 @@ self.onmessage = async function(e) {
             }
 
             currentTool = toolName;
+            swiftamrIndexHash = null;
+            swiftamrCachedIndexes = new Map();
+            swiftamrFeatures = {};
             const config = TOOL_CONFIGS[toolName];
 
             // Import the tool module script
@@ -109,6 +263,19 @@ self.onmessage = async function(e) {
 
                 // Debug: check what's available
                 self.postMessage({ type: 'log', text: `Module properties: ${Object.keys(toolModule).filter(k => k.includes('HEA') || k.includes('memory') || k.includes('malloc')).join(', ')}` });
+
+                const missing = swiftamrMissingExports(toolModule);
+                if (missing.length > 0) {
+                    toolModule = null;
+                    throw new Error(`swiftamr.wasm is out of date (missing ${missing.join(', ')}); rebuild it with make wasm`);
+                }
+                swiftamrFeatures = swiftamrFeatureSet(toolModule);
+
+                if (typeof indexedDB !== 'undefined') {
+                    installSwiftAMRIndexStorage(toolModule);
+                }
+                installSwiftAMRProgress(toolModule);
+                installSwiftAMRCancel(toolModule);
             } else {
                 toolModule = await Module({
                 locateFile: (path) => {
@@ -167,7 +334,8 @@ self.onmessage = async function(e) {
             self.postMessage({
                 type: 'init-complete',
                 success: true,
-                toolName: toolName
+                toolName: toolName,
+                features: toolName === 'swiftamr' ? swiftamrFeatures : null
             });
         } catch (error) {
             self.postMessage({
@@ -220,6 +388,18 @@ self.onmessage = async function(e) {
                     throw new Error('SwiftAMR requires AMR database FASTA file');
                 }
 
+                // The page disables the controls of features this module lacks;
+                // refuse a request for one before any work is done
+                const paired = !!inputFileData2 || !!data.interleaved;
+                const unsupported = [
+                    paired && !swiftamrFeatures.pairs && 'paired-end input',
+                    data.outputFormat === 'preview' && !swiftamrFeatures.preview && 'quick preview',
+                    data.trace && !swiftamrFeatures.trace && 'performance traces'
+                ].filter(Boolean);
+                if (unsupported.length > 0) {
+                    throw new Error(`This swiftamr.wasm does not support ${unsupported.join(', ')}; rebuild it with make wasm`);
+                }
+
                 self.postMessage({ type: 'log', text: `Loading AMR database (${(databaseData.byteLength / 1024 / 1024).toFixed(2)} MB)...` });
 
                 // Build k-mer index from FASTA database
@@ -229,6 +409,10 @@ self.onmessage = async function(e) {
                 const malloc = toolModule._malloc;
                 const free = toolModule._free;
                 const buildIndex = toolModule.cwrap('swiftamr_build_index', 'number', ['number', 'number']);
+                const databaseHash = toolModule.cwrap('swiftamr_database_hash', 'number', ['number', 'number']);
+                const databaseCacheKey = toolModule.cwrap('swiftamr_database_cache_key', 'number', ['number', 'number']);
+                const getHash = toolModule.cwrap('swiftamr_get_hash', 'string', []);
+                const cleanup = toolModule.cwrap('swiftamr_cleanup', null, []);
 
                 // Allocate memory and copy data
                 const dbPtr = malloc(dbUint8Array.length);
@@ -245,60 +429,160 @@ self.onmessage = async function(e) {
                     heap.set(dbUint8Array, dbPtr);
                 }
 
-                const genesAdded = buildIndex(dbPtr, dbUint8Array.length);
-                free(dbPtr);
+                // Optional Chrome trace of this run (index build through output)
+                if (data.trace) toolModule.ccall('swiftamr_trace_start', null, [], []);
 
-                if (genesAdded < 0) {
-                    throw new Error('Failed to build k-mer index from database');
-                }
+                // The index stays loaded between runs; rebuild only when the
+                // database (or the index options) changed
+                const hashPtr = databaseHash(dbPtr, dbUint8Array.length);
+                const dbHash = toolModule.UTF8ToString(hashPtr);
+                free(hashPtr);
 
-                self.postMessage({ type: 'log', text: `Built k-mer index: ${genesAdded} genes` });
+                if (dbHash === swiftamrIndexHash) {
+                    free(dbPtr);
+                    self.postMessage({ type: 'log', text: `Reusing loaded k-mer index (database ${dbHash})` });
+                } else {
+                    if (swiftamrIndexHash !== null) {
+                        cleanup();
+                        swiftamrIndexHash = null;
+                    }
 
-                // Align FASTQ reads
-                const fastqUint8Array = new Uint8Array(inputFileData);
-                self.postMessage({ type: 'log', text: `Aligning ${inputFileName} (${(fastqUint8Array.length / 1024).toFixed(2)} KB)...` });
+                    // Fetch a previously serialized index for the build to load
+                    const keyPtr = databaseCacheKey(dbPtr, dbUint8Array.length);
+                    const cacheKey = toolModule.UTF8ToString(keyPtr);
+                    free(keyPtr);
+                    let cached = null;
+                    if (typeof indexedDB !== 'undefined') {
+                        try {
+                            cached = await readCachedIndex(cacheKey);
+                        } catch (error) {
+                            self.postMessage({ type: 'log', text: `Index cache unavailable: ${error.message}` });
+                        }
+                    }
+                    if (cached) swiftamrCachedIndexes.set(cacheKey, cached);
 
-                const alignFastq = toolModule.cwrap('swiftamr_align_fastq', 'number', ['number', 'number']);
-                const fastqPtr = malloc(fastqUint8Array.length);
+                    const genesAdded = buildIndex(dbPtr, dbUint8Array.length);
+                    free(dbPtr);
+                    swiftamrCachedIndexes.delete(cacheKey);
 
-                // Write FASTQ data to memory
-                if (toolModule.writeArrayToMemory) {
-                    toolModule.writeArrayToMemory(fastqUint8Array, fastqPtr);
-                } else if (toolModule.HEAPU8) {
-                    toolModule.HEAPU8.set(fastqUint8Array, fastqPtr);
-                } else {
-                    const memoryBuffer = toolModule.wasmMemory ? toolModule.wasmMemory.buffer : toolModule.memory.buffer;
-                    const heap = new Uint8Array(memoryBuffer);
-                    heap.set(fastqUint8Array, fastqPtr);
+                    if (genesAdded < 0) {
+                        throw new Error('Failed to build k-mer index from database');
+                    }
+
+                    swiftamrIndexHash = getHash();
+                    self.postMessage({ type: 'log', text: `${cached ? 'Loaded cached' : 'Built'} k-mer index: ${genesAdded} genes (database ${swiftamrIndexHash})` });
+                }
+
+                // Align FASTQ reads; linked R1/R2 files or interleaved input are aligned as pairs
+                const fastqUint8Array = new Uint8Array(inputFileData);
+                const fastqUint8Array2 = inputFileData2 ? new Uint8Array(inputFileData2) : null;
+                self.postMessage({ type: 'log', text: fastqUint8Array2
+                    ? `Aligning pairs ${inputFileName} & ${inputFileName2} (${((fastqUint8Array.length + fastqUint8Array2.length) / 1024).toFixed(2)} KB)...`
+                    : `Aligning ${inputFileName}${paired ? ' (interleaved pairs)' : ''} (${(fastqUint8Array.length / 1024).toFixed(2)} KB)...` });
+
+                // 0 = per-read TSV, 1 = binary, 2 = per-gene summary TSV, 3 = preview TSV
+                const outputFormat = { binary: 1, summary: 2, preview: 3 }[data.outputFormat] || 0;
+                const binaryOutput = outputFormat === 1;
+                const alignFastq = toolModule.cwrap('swiftamr_align_fastq_to_buffer', 'number', ['number', 'number', 'number']);
+                const alignPairs = toolModule.cwrap('swiftamr_align_pairs_to_buffer', 'number', ['number', 'number', 'number', 'number', 'number']);
+                const outputData = toolModule.cwrap('swiftamr_output_data', 'number', []);
+                const outputSize = toolModule.cwrap('swiftamr_output_size', 'number', []);
+                const outputRelease = toolModule.cwrap('swiftamr_output_release', null, []);
+
+                // Preview stops at convergence or after the time budget (0 = none)
+                if (outputFormat === 3) {
+                    toolModule.ccall('swiftamr_set_preview_options', null, ['number', 'number', 'number', 'number'],
+                        [data.previewSeconds || 0, 0, 0, 1]);
                 }
 
-                const resultsPtr = alignFastq(fastqPtr, fastqUint8Array.length);
+                // Write FASTQ data to memory
+                const writeFastq = (bytes) => {
+                    const ptr = malloc(bytes.length);
+                    if (toolModule.writeArrayToMemory) {
+                        toolModule.writeArrayToMemory(bytes, ptr);
+                    } else if (toolModule.HEAPU8) {
+                        toolModule.HEAPU8.set(bytes, ptr);
+                    } else {
+                        const memoryBuffer = toolModule.wasmMemory ? toolModule.wasmMemory.buffer : toolModule.memory.buffer;
+                        const heap = new Uint8Array(memoryBuffer);
+                        heap.set(bytes, ptr);
+                    }
+                    return ptr;
+                };
+                const fastqPtr = writeFastq(fastqUint8Array);
+                const fastqPtr2 = fastqUint8Array2 ? writeFastq(fastqUint8Array2) : 0;
+
+                // The page passes a SharedArrayBuffer when it can cancel this run
+                swiftamrCancelFlag = data.cancelBuffer ? new Int32Array(data.cancelBuffer) : null;
+                swiftamrCancelled = false;
+
+                // A null R2 pointer means interleaved mates in the first buffer
+                const rows = paired
+                    ? alignPairs(fastqPtr, fastqUint8Array.length, fastqPtr2, fastqUint8Array2 ? fastqUint8Array2.length : 0, outputFormat)
+                    : alignFastq(fastqPtr, fastqUint8Array.length, outputFormat);
+                swiftamrCancelFlag = null;
                 free(fastqPtr);
+                if (fastqPtr2) free(fastqPtr2);
+
+                if (rows < 0) {
+                    outputRelease();
+                    throw new Error('SwiftAMR alignment failed');
+                }
 
-                // Read results (TSV string)
-                const results = toolModule.UTF8ToString(resultsPtr);
-                free(resultsPtr);
+                // Copy the result bytes out of WASM memory in one slice; the
+                // copy owns its ArrayBuffer, which is transferred back to the page
+                const resultsPtr = outputData();
+                const heap = toolModule.HEAPU8 || new Uint8Array(toolModule.wasmMemory ? toolModule.wasmMemory.buffer : toolModule.memory.buffer);
+                const resultsData = heap.slice(resultsPtr, resultsPtr + outputSize());
+                outputRelease();
+
+                // A cancelled run still returns the rows aligned so far; the
+                // index stays loaded for the next run
+                self.postMessage({ type: 'log', text: swiftamrCancelled
+                    ? `Alignment cancelled: partial results for ${rows} ${paired ? 'pairs' : 'reads'}`
+                    : `Alignment complete: ${rows} ${paired ? 'pairs' : 'reads'}` });
+
+                // Hot-path counters and phase times, so logs show where the time went
+                const countersPtr = swiftamrFeatures.counters ? toolModule.ccall('swiftamr_get_counters', 'number', [], []) : 0;
+                if (countersPtr) {
+                    self.postMessage({ type: 'log', text: `SwiftAMR counters: ${toolModule.UTF8ToString(countersPtr)}` });
+                    free(countersPtr);
+                }
 
-                self.postMessage({ type: 'log', text: `Alignment complete` });
+                // Trace spans as a downloadable file; open it in Perfetto (ui.perfetto.dev)
+                let traceFile = null;
+                if (data.trace) {
+                    const tracePtr = toolModule.ccall('swiftamr_trace_stop', 'number', [], []);
+                    if (tracePtr) {
+                        const traceData = new TextEncoder().encode(toolModule.UTF8ToString(tracePtr));
+                        free(tracePtr);
+                        traceFile = {
+                            name: inputFileName.replace(/\.(fastq|fq)(\.gz)?$/i, '_amr_trace.json'),
+                            data: traceData,
+                            type: 'application/json',
+                            size: traceData.byteLength,
+                            category: 'output'
+                        };
+                    }
+                }
 
                 // Create output file
-                const outputFileName = inputFileName.replace(/\.(fastq|fq)(\.gz)?$/i, '_amr_results.tsv');
-                const encoder = new TextEncoder();
-                const resultsData = encoder.encode(results);
+                const outputFileName = inputFileName.replace(/\.(fastq|fq)(\.gz)?$/i,
+                    ['_amr_results.tsv', '_amr_results.samr', '_amr_genes.tsv', '_amr_preview.tsv'][outputFormat]);
 
                 outputFiles.push({
                     name: outputFileName,
                     data: resultsData,
-                    type: 'text/plain',
+                    type: binaryOutput ? 'application/octet-stream' : 'text/plain',
                     size: resultsData.byteLength,
                     category: 'output'
                 });
 
                 self.postMessage({ type: 'log', text: `Created: ${outputFileName} (${resultsData.byteLength} bytes)` });
-
-                // Cleanup
-                const cleanup = toolModule.cwrap('swiftamr_cleanup', null, []);
-                cleanup();
+                if (traceFile) {
+                    outputFiles.push(traceFile);
+                    self.postMessage({ type: 'log', text: `Created: ${traceFile.name} (${traceFile.size} bytes)` });
+                }
 
             } else {
                 // Standard tool execution (fastp, bowtie2, etc.)
@@ -366,7 +650,8 @@ self.onmessage = async function(e) {
                 type: 'complete',
                 success: true,
                 outputFiles,
-                returnCode
+                returnCode,
+                cancelled: swiftamrCancelled
             }, transferables);
 
         } catch (error) {
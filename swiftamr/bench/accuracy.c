@@ -0,0 +1,304 @@
+// SwiftAMR accuracy-versus-throughput harness: aligns simulated reads of
+// known origin under several index/alignment configurations and reports
+// reads/sec, recall, precision and tie rate for each. With --baseline it
+// exits non-zero when a configuration regresses past the recorded values
+// (make accuracy); --write-baseline records new ones (make accuracy-baseline).
+#include "harness.h"
+#include "simreads.h"
+
+typedef struct {
+    const char* name;
+    uint32_t kmer_stride;
+    uint32_t max_kmer_hits;
+    int seed_extend;
+} AccuracyConfig;
+
+static const AccuracyConfig CONFIGS[] = {
+    {"default", 1, 0, 1},
+    {"no-extend", 1, 0, 0},
+    {"stride-2", 2, 0, 1},
+    {"stride-4", 4, 0, 1},
+    {"max-hits-8", 1, 8, 1},
+};
+#define NUM_CONFIGS (sizeof(CONFIGS) / sizeof(CONFIGS[0]))
+#define REFERENCE_CONFIG 1 // no-extend: throughput is checked relative to it, measured in the same run
+
+typedef struct {
+    double reads_per_sec;
+    double recall;        // On-target reads assigned to their source gene
+    double recall_fwd;
+    double recall_rev;
+    double precision;     // Assigned reads whose gene is the source gene
+    double tie_rate;      // Reads whose best score was shared by another gene
+} AccuracyReport;
+
+// Assigned gene of each simulated read, by its number in the name "sim_<i>"
+typedef struct {
+    uint32_t* assigned;
+    uint32_t num_reads;
+} Assignments;
+
+static void record_rows(const ResultBuffer* batch, void* user_data) {
+    Assignments* a = (Assignments*)user_data;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const char* name = batch->source + batch->name_offset[i];
+        if (batch->name_length[i] < 5 || strncmp(name, "sim_", 4) != 0) continue;
+        unsigned long r = strtoul(name + 4, NULL, 10);
+        if (r < a->num_reads) a->assigned[r] = batch->gene_id[i];
+    }
+}
+
+static int run_config(const AccuracyConfig* config, const char* fasta, size_t fasta_size,
+                      const SimOptions* sim, int repeat, AccuracyReport* report) {
+    IndexOptions index_opts;
+    AlignOptions align_opts;
+    index_options_default(&index_opts);
+    align_options_default(&align_opts);
+    index_opts.kmer_stride = config->kmer_stride;
+    index_opts.max_kmer_hits = config->max_kmer_hits;
+    align_opts.seed_extend = config->seed_extend;
+
+    KmerIndex* index = index_create(&index_opts);
+    if (!index || index_build_from_fasta(index, fasta, fasta_size) <= 0) {
+        index_destroy(index);
+        return -1;
+    }
+    index_finalize(index);
+
+    SimTruth* truth = (SimTruth*)malloc(sim->num_reads * sizeof(SimTruth));
+    Assignments a = {(uint32_t*)malloc(sim->num_reads * sizeof(uint32_t)), sim->num_reads};
+    size_t fastq_size = 0;
+    char* fastq = truth && a.assigned ? simulate_reads(index, sim, &fastq_size, truth) : NULL;
+    int ret = fastq ? 0 : -1;
+
+    double best_seconds = 0;
+    AlignStats stats;
+    for (int r = 0; ret == 0 && r < repeat; r++) {
+        memset(&stats, 0, sizeof(stats));
+        for (uint32_t i = 0; i < sim->num_reads; i++) a.assigned[i] = UINT32_MAX;
+        double t0 = harness_now_seconds();
+        if (align_fastq_stream(index, &align_opts, fastq, fastq_size, record_rows, &a, &stats) < 0) ret = -1;
+        double seconds = harness_now_seconds() - t0;
+        if (r == 0 || seconds < best_seconds) best_seconds = seconds;
+    }
+
+    if (ret == 0) {
+        uint64_t on_target[2] = {0, 0}, correct[2] = {0, 0}, assigned = 0;
+        for (uint32_t i = 0; i < sim->num_reads; i++) {
+            if (a.assigned[i] != UINT32_MAX) assigned++;
+            if (truth[i].gene_id == SIM_OFF_TARGET) continue;
+            on_target[truth[i].reverse]++;
+            if (a.assigned[i] == truth[i].gene_id) correct[truth[i].reverse]++;
+        }
+        uint64_t total_on = on_target[0] + on_target[1], total_correct = correct[0] + correct[1];
+        report->reads_per_sec = best_seconds > 0 ? sim->num_reads / best_seconds : 0;
+        report->recall = total_on ? (double)total_correct / total_on : 0;
+        report->recall_fwd = on_target[0] ? (double)correct[0] / on_target[0] : 0;
+        report->recall_rev = on_target[1] ? (double)correct[1] / on_target[1] : 0;
+        report->precision = assigned ? (double)total_correct / assigned : 0;
+        report->tie_rate = assigned ? (double)stats.reads_tied / assigned : 0;
+    }
+
+    free(fastq);
+    free(truth);
+    free(a.assigned);
+    index_destroy(index);
+    return ret;
+}
+
+// Simulation parameters as recorded in the baseline; a baseline is only
+// comparable with runs on the same reads
+static void format_sim(char* out, size_t size, const SimOptions* sim, const char* db_path) {
+    snprintf(out, size, "# reads=%u length=%u error=%.4f reverse=%.2f off_target=%.2f seed=%llu k=%d db=%s",
+             sim->num_reads, sim->read_length, sim->error_rate, sim->reverse_fraction,
+             sim->offtarget_fraction, (unsigned long long)sim->seed, KMER_SIZE, db_path);
+}
+
+static int write_baseline(const char* path, const char* sim_line, const AccuracyReport* reports) {
+    FILE* file = fopen(path, "w");
+    if (!file) return -1;
+    fprintf(file, "# SwiftAMR accuracy baseline, written by make accuracy-baseline\n%s\n", sim_line);
+    fprintf(file, "config\treads_per_sec\trecall\tprecision\ttie_rate\n");
+    for (size_t c = 0; c < NUM_CONFIGS; c++) {
+        fprintf(file, "%s\t%.0f\t%.4f\t%.4f\t%.4f\n", CONFIGS[c].name, reports[c].reads_per_sec,
+                reports[c].recall, reports[c].precision, reports[c].tie_rate);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Compare against the baseline; returns the number of regressions, or -1
+// if the baseline cannot be read or was recorded on different reads.
+// Recall, precision and tie rate are compared directly. Reads/sec depends on
+// the machine, so each configuration's speed relative to REFERENCE_CONFIG is
+// compared with the same ratio in the baseline instead.
+static int check_baseline(const char* path, const char* sim_line, const AccuracyReport* reports,
+                          double throughput_tolerance, double accuracy_tolerance) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("ERROR: Cannot open baseline %s\n", path);
+        return -1;
+    }
+
+    AccuracyReport base[NUM_CONFIGS];
+    int found[NUM_CONFIGS] = {0};
+    char line[1024];
+    int sim_matches = 0, regressions = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "# reads=", 8) == 0) {
+            sim_matches = strcmp(line, sim_line) == 0;
+            continue;
+        }
+        if (line[0] == '#' || strncmp(line, "config\t", 7) == 0 || line[0] == '\0') continue;
+
+        char name[64];
+        AccuracyReport row;
+        if (sscanf(line, "%63s %lf %lf %lf %lf", name, &row.reads_per_sec, &row.recall, &row.precision,
+                   &row.tie_rate) != 5) {
+            continue;
+        }
+        for (size_t c = 0; c < NUM_CONFIGS; c++) {
+            if (strcmp(CONFIGS[c].name, name) != 0) continue;
+            base[c] = row;
+            found[c] = 1;
+        }
+    }
+    fclose(file);
+
+    if (!sim_matches) {
+        printf("ERROR: Baseline %s was recorded with different reads; expected\n%s\n", path, sim_line);
+        return -1;
+    }
+
+    double base_ref = found[REFERENCE_CONFIG] ? base[REFERENCE_CONFIG].reads_per_sec : 0;
+    double ref = reports[REFERENCE_CONFIG].reads_per_sec;
+    for (size_t c = 0; c < NUM_CONFIGS; c++) {
+        if (!found[c]) continue;
+        const char* name = CONFIGS[c].name;
+        const AccuracyReport* r = &reports[c];
+        if (c != REFERENCE_CONFIG && base_ref > 0 && ref > 0) {
+            double speedup = r->reads_per_sec / ref;
+            double base_speedup = base[c].reads_per_sec / base_ref;
+            if (speedup < base_speedup * (1.0 - throughput_tolerance)) {
+                printf("REGRESSION: %s reads/sec %.2fx %s < baseline %.2fx\n", name, speedup,
+                       CONFIGS[REFERENCE_CONFIG].name, base_speedup);
+                regressions++;
+            }
+        }
+        if (r->recall < base[c].recall - accuracy_tolerance) {
+            printf("REGRESSION: %s recall %.4f < baseline %.4f\n", name, r->recall, base[c].recall);
+            regressions++;
+        }
+        if (r->precision < base[c].precision - accuracy_tolerance) {
+            printf("REGRESSION: %s precision %.4f < baseline %.4f\n", name, r->precision, base[c].precision);
+            regressions++;
+        }
+        if (r->tie_rate > base[c].tie_rate + accuracy_tolerance) {
+            printf("REGRESSION: %s tie rate %.4f > baseline %.4f\n", name, r->tie_rate, base[c].tie_rate);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] <database.fasta>\n", prog);
+    printf("  --reads N                Simulated reads per configuration (default: 20000)\n");
+    printf("  --length L               Read length (default: 150)\n");
+    printf("  --error-rate E           Per-base substitution rate (default: 0.01)\n");
+    printf("  --reverse F              Fraction of reverse-strand reads (default: 0.5)\n");
+    printf("  --off-target F           Fraction of random reads (default: 0.1)\n");
+    printf("  --seed S                 Random seed (default: 1)\n");
+    printf("  --repeat R               Alignment passes; the fastest is reported (default: 3)\n");
+    printf("  --baseline PATH          Fail if any configuration regresses past PATH\n");
+    printf("  --write-baseline PATH    Record this run as the baseline\n");
+    printf("  --throughput-tolerance F Allowed drop in reads/sec relative to no-extend, as a fraction (default: 0.5)\n");
+    printf("  --accuracy-tolerance D   Allowed recall/precision drop and tie-rate rise (default: 0.01)\n");
+}
+
+int main(int argc, char** argv) {
+    SimOptions sim;
+    sim_options_default(&sim);
+    sim.num_reads = 20000;
+    int repeat = 3;
+    double throughput_tolerance = 0.5, accuracy_tolerance = 0.01;
+    const char* baseline_path = NULL;
+    const char* write_path = NULL;
+    const char* db_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--reads") == 0 && i + 1 < argc) {
+            sim.num_reads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--length") == 0 && i + 1 < argc) {
+            sim.read_length = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--error-rate") == 0 && i + 1 < argc) {
+            sim.error_rate = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--reverse") == 0 && i + 1 < argc) {
+            sim.reverse_fraction = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--off-target") == 0 && i + 1 < argc) {
+            sim.offtarget_fraction = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--seed") == 0 && i + 1 < argc) {
+            sim.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(arg, "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(arg, "--write-baseline") == 0 && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (strcmp(arg, "--throughput-tolerance") == 0 && i + 1 < argc) {
+            throughput_tolerance = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--accuracy-tolerance") == 0 && i + 1 < argc) {
+            accuracy_tolerance = strtod(argv[++i], NULL);
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            db_path = arg;
+        }
+    }
+    if (!db_path || repeat < 1 || sim.num_reads == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    size_t fasta_size;
+    char* fasta = harness_read_file(db_path, &fasta_size);
+    if (!fasta) {
+        printf("ERROR: Cannot open FASTA file\n");
+        return 1;
+    }
+
+    char sim_line[512];
+    format_sim(sim_line, sizeof(sim_line), &sim, db_path);
+    printf("%s\n", sim_line);
+    printf("config\treads_per_sec\trecall\trecall_fwd\trecall_rev\tprecision\ttie_rate\n");
+
+    AccuracyReport reports[NUM_CONFIGS];
+    for (size_t c = 0; c < NUM_CONFIGS; c++) {
+        if (run_config(&CONFIGS[c], fasta, fasta_size, &sim, repeat, &reports[c]) < 0) {
+            printf("ERROR: Configuration %s failed\n", CONFIGS[c].name);
+            free(fasta);
+            return 1;
+        }
+        const AccuracyReport* r = &reports[c];
+        printf("%s\t%.0f\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", CONFIGS[c].name, r->reads_per_sec,
+               r->recall, r->recall_fwd, r->recall_rev, r->precision, r->tie_rate);
+    }
+    free(fasta);
+
+    if (write_path) {
+        if (write_baseline(write_path, sim_line, reports) < 0) {
+            printf("ERROR: Cannot write baseline %s\n", write_path);
+            return 1;
+        }
+        printf("Baseline written to %s\n", write_path);
+    }
+
+    if (baseline_path) {
+        int regressions = check_baseline(baseline_path, sim_line, reports, throughput_tolerance, accuracy_tolerance);
+        if (regressions != 0) return 1;
+        printf("No regressions against %s\n", baseline_path);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+// SwiftAMR throughput benchmark: builds the index for a database, aligns
+// synthetic reads generated from it and reports build time, reads/sec,
+// ns per k-mer lookup and peak memory. Built natively by `make bench` and
+// for Node by `make bench-wasm`.
+#include "harness.h"
+#include "simreads.h"
+
+static void count_rows(const ResultBuffer* batch, void* user_data) {
+    uint64_t* hits = (uint64_t*)user_data;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (batch->gene_id[i] != UINT32_MAX) (*hits)++;
+    }
+}
+
+// Every valid k-mer of every read, in FASTQ order
+static uint64_t* collect_kmers(const char* fastq, size_t size, uint64_t* count) {
+    uint64_t capacity = 1 << 16, n = 0;
+    uint64_t* kmers = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    size_t pos = 0;
+    while (kmers && pos < size) {
+        // Header, sequence, '+', quality
+        while (pos < size && fastq[pos] != '\n') pos++;
+        size_t start = ++pos;
+        while (pos < size && fastq[pos] != '\n') pos++;
+        for (size_t i = start; i + KMER_SIZE <= pos; i++) {
+            if (!kmer_is_valid(fastq + i)) continue;
+            if (n == capacity) {
+                capacity *= 2;
+                uint64_t* grown = (uint64_t*)realloc(kmers, capacity * sizeof(uint64_t));
+                if (!grown) {
+                    free(kmers);
+                    return NULL;
+                }
+                kmers = grown;
+            }
+            kmers[n++] = kmer_encode(fastq + i);
+        }
+        for (int line = 0; line < 2 && pos < size; line++) {
+            pos++;
+            while (pos < size && fastq[pos] != '\n') pos++;
+        }
+        pos++;
+    }
+    *count = n;
+    return kmers;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] <database.fasta>\n", prog);
+    printf("  --reads N           Synthetic reads to align (default: 100000)\n");
+    printf("  --length L          Read length (default: 150)\n");
+    printf("  --error-rate E      Per-base substitution rate (default: 0.01)\n");
+    printf("  --reverse F         Fraction of reverse-strand reads (default: 0.5)\n");
+    printf("  --off-target F      Fraction of random reads (default: 0.1)\n");
+    printf("  --seed S            Random seed (default: 1)\n");
+    printf("  --repeat R          Alignment passes; the fastest is reported (default: 3)\n");
+    printf("  --kmer-stride N     Index every N-th reference k-mer (default: 1)\n");
+    printf("  --no-extend         Look up every k-mer instead of extending seed hits\n");
+    printf("  --write-fastq PATH  Also save the synthetic reads\n");
+}
+
+int main(int argc, char** argv) {
+    SimOptions sim;
+    IndexOptions index_opts;
+    AlignOptions align_opts;
+    sim_options_default(&sim);
+    index_options_default(&index_opts);
+    align_options_default(&align_opts);
+    int repeat = 3;
+    const char* fastq_path = NULL;
+    const char* db_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--reads") == 0 && i + 1 < argc) {
+            sim.num_reads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--length") == 0 && i + 1 < argc) {
+            sim.read_length = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--error-rate") == 0 && i + 1 < argc) {
+            sim.error_rate = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--reverse") == 0 && i + 1 < argc) {
+            sim.reverse_fraction = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--off-target") == 0 && i + 1 < argc) {
+            sim.offtarget_fraction = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--seed") == 0 && i + 1 < argc) {
+            sim.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(arg, "--kmer-stride") == 0 && i + 1 < argc) {
+            index_opts.kmer_stride = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--no-extend") == 0) {
+            align_opts.seed_extend = 0;
+        } else if (strcmp(arg, "--write-fastq") == 0 && i + 1 < argc) {
+            fastq_path = argv[++i];
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            db_path = arg;
+        }
+    }
+    if (!db_path || repeat < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    size_t fasta_size;
+    char* fasta = harness_read_file(db_path, &fasta_size);
+    if (!fasta) {
+        printf("ERROR: Cannot open FASTA file\n");
+        return 1;
+    }
+
+    // Index build
+    double t0 = harness_now_seconds();
+    KmerIndex* index = index_create(&index_opts);
+    int genes = index ? index_build_from_fasta(index, fasta, fasta_size) : -1;
+    if (genes <= 0) {
+        printf("ERROR: Failed to build index\n");
+        return 1;
+    }
+    index_finalize(index);
+    double build_seconds = harness_now_seconds() - t0;
+    free(fasta);
+
+    // Reads
+    size_t fastq_size;
+    char* fastq = simulate_reads(index, &sim, &fastq_size, NULL);
+    if (!fastq) {
+        printf("ERROR: Failed to generate reads\n");
+        return 1;
+    }
+    if (fastq_path) {
+        FILE* file = fopen(fastq_path, "w");
+        if (!file || fwrite(fastq, 1, fastq_size, file) != fastq_size) {
+            printf("ERROR: Cannot write %s\n", fastq_path);
+            return 1;
+        }
+        fclose(file);
+    }
+
+    // Whole-pipeline alignment; the fastest pass is the least noisy
+    double align_seconds = 0;
+    uint64_t hits = 0;
+    for (int r = 0; r < repeat; r++) {
+        AlignStats stats = {0};
+        hits = 0;
+        t0 = harness_now_seconds();
+        int aligned = align_fastq_stream(index, &align_opts, fastq, fastq_size, count_rows, &hits, &stats);
+        double seconds = harness_now_seconds() - t0;
+        if (aligned < 0) {
+            printf("ERROR: Alignment failed\n");
+            return 1;
+        }
+        if (r == 0 || seconds < align_seconds) align_seconds = seconds;
+    }
+
+    // Hash table lookups alone, over every read k-mer
+    uint64_t num_kmers = 0, found = 0;
+    uint64_t* kmers = collect_kmers(fastq, fastq_size, &num_kmers);
+    if (!kmers) {
+        printf("ERROR: Out of memory\n");
+        return 1;
+    }
+    double lookup_seconds = 0;
+    for (int r = 0; r < repeat; r++) {
+        found = 0;
+        t0 = harness_now_seconds();
+        for (uint64_t i = 0; i < num_kmers; i++) {
+            if (kmer_lookup(index, kmers[i])) found++;
+        }
+        double seconds = harness_now_seconds() - t0;
+        if (r == 0 || seconds < lookup_seconds) lookup_seconds = seconds;
+    }
+
+    printf("database:        %s (%d genes, %u distinct k-mers)\n", db_path, genes, index->stats.distinct_kmers);
+    printf("reads:           %u x %u bp, error %.3f, reverse %.2f, off-target %.2f, seed %llu\n",
+           sim.num_reads, sim.read_length, sim.error_rate, sim.reverse_fraction, sim.offtarget_fraction,
+           (unsigned long long)sim.seed);
+    printf("index_build_ms:  %.2f\n", build_seconds * 1e3);
+    printf("align_ms:        %.2f\n", align_seconds * 1e3);
+    printf("reads_per_sec:   %.0f\n", align_seconds > 0 ? sim.num_reads / align_seconds : 0.0);
+    printf("reads_with_hit:  %llu\n", (unsigned long long)hits);
+    printf("ns_per_lookup:   %.2f (%llu lookups, %.1f%% found)\n",
+           num_kmers ? lookup_seconds * 1e9 / num_kmers : 0.0, (unsigned long long)num_kmers,
+           num_kmers ? 100.0 * found / num_kmers : 0.0);
+    printf("peak_rss_kb:     %llu\n", (unsigned long long)harness_peak_memory_kb());
+
+    free(kmers);
+    free(fastq);
+    index_destroy(index);
+    return 0;
+}
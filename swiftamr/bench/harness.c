@@ -0,0 +1,43 @@
+#define _POSIX_C_SOURCE 200809L
+#include "harness.h"
+#include <time.h>
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#else
+#include <sys/resource.h>
+#endif
+
+double harness_now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Peak resident memory in KB (WASM: linear memory size, which only grows)
+uint64_t harness_peak_memory_kb(void) {
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_heap_size() / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)usage.ru_maxrss;
+#endif
+}
+
+// Read a whole file into a NUL-terminated buffer; NULL if it cannot be opened
+char* harness_read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = (char*)malloc(*size + 1);
+    if (data) {
+        *size = fread(data, 1, *size, file);
+        data[*size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
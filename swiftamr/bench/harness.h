@@ -0,0 +1,11 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "swiftamr.h"
+
+// Helpers shared by the benchmark programs
+double harness_now_seconds(void);
+uint64_t harness_peak_memory_kb(void);
+char* harness_read_file(const char* path, size_t* size);
+
+#endif // HARNESS_H
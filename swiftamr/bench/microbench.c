@@ -0,0 +1,487 @@
+// SwiftAMR kernel microbenchmarks: k-mer encoding, hash lookups, FASTQ
+// record splitting and TSV formatting, each timed in isolation on synthetic
+// reads. Kernels with several variants report the same checksum when the
+// variants agree, so a faster variant is also checked for correctness.
+#include "harness.h"
+#include "simreads.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static uint64_t cycles_now(void) {
+#ifdef HAVE_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Reads as parsed by fastq_next, back to back
+typedef struct {
+    char* bases;
+    uint32_t* offset;   // Start of each read in bases; offset[num_reads] = total
+    uint32_t num_reads;
+} ReadSet;
+
+typedef struct {
+    ReadSet reads;
+    KmerIndex* index;
+    const char* fastq;
+    size_t fastq_size;
+    uint64_t* kmers;        // Every valid read k-mer
+    uint64_t* random_kmers; // Same number of uniformly random k-mers
+    uint64_t num_kmers;
+    ResultBuffer rows;
+} BenchData;
+
+typedef uint64_t (*KernelFn)(const BenchData* data);
+
+// ---- k-mer encoding: every valid k-mer of every read, summed ----
+
+// Per-window validation and encoding (kmer_is_valid + kmer_encode)
+static uint64_t encode_scalar(const BenchData* d) {
+    uint64_t sum = 0;
+    for (uint32_t r = 0; r < d->reads.num_reads; r++) {
+        const char* seq = d->reads.bases + d->reads.offset[r];
+        uint32_t len = d->reads.offset[r + 1] - d->reads.offset[r];
+        for (uint32_t i = 0; i + KMER_SIZE <= len; i++) {
+            if (kmer_is_valid(seq + i)) sum += kmer_encode(seq + i);
+        }
+    }
+    return sum;
+}
+
+static inline int base_code_switch(char c) {
+    switch (c) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return -1;
+    }
+}
+
+// Rolling encoder with a per-base switch, as in align_read
+static uint64_t encode_rolling(const BenchData* d) {
+    uint64_t sum = 0;
+    for (uint32_t r = 0; r < d->reads.num_reads; r++) {
+        const char* seq = d->reads.bases + d->reads.offset[r];
+        uint32_t len = d->reads.offset[r + 1] - d->reads.offset[r];
+        uint64_t kmer = 0;
+        uint32_t run = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            int nt = base_code_switch(seq[i]);
+            if (nt < 0) {
+                run = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | nt) & KMER_MASK;
+            if (++run >= KMER_SIZE) sum += kmer;
+        }
+    }
+    return sum;
+}
+
+// 4 = not ACGT
+static uint8_t BASE_TABLE[256];
+
+static void base_table_init(void) {
+    memset(BASE_TABLE, 4, sizeof(BASE_TABLE));
+    BASE_TABLE['A'] = BASE_TABLE['a'] = 0;
+    BASE_TABLE['C'] = BASE_TABLE['c'] = 1;
+    BASE_TABLE['G'] = BASE_TABLE['g'] = 2;
+    BASE_TABLE['T'] = BASE_TABLE['t'] = 3;
+}
+
+// Rolling encoder with a 256-entry lookup table
+static uint64_t encode_rolling_table(const BenchData* d) {
+    uint64_t sum = 0;
+    for (uint32_t r = 0; r < d->reads.num_reads; r++) {
+        const uint8_t* seq = (const uint8_t*)d->reads.bases + d->reads.offset[r];
+        uint32_t len = d->reads.offset[r + 1] - d->reads.offset[r];
+        uint64_t kmer = 0;
+        uint32_t run = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            uint8_t nt = BASE_TABLE[seq[i]];
+            if (nt > 3) {
+                run = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | nt) & KMER_MASK;
+            if (++run >= KMER_SIZE) sum += kmer;
+        }
+    }
+    return sum;
+}
+
+// Roll codes[0..n) (4 = invalid) into the running k-mer
+static inline uint64_t roll_codes(const uint8_t* codes, uint32_t n, uint64_t* kmer, uint32_t* run) {
+    uint64_t sum = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        if (codes[j] > 3) {
+            *run = 0;
+            continue;
+        }
+        *kmer = ((*kmer << 2) | codes[j]) & KMER_MASK;
+        if (++*run >= KMER_SIZE) sum += *kmer;
+    }
+    return sum;
+}
+
+// Bytes of x equal to zero get their high bit set
+static inline uint64_t zero_bytes(uint64_t x) {
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    return ~(((x & low7) + low7) | x | low7);
+}
+
+// SWAR: classify and code 8 upper-case bases per 64-bit word. For A, C, G
+// and T, ((c >> 1) ^ (c >> 2)) & 3 is 0, 1, 2 and 3.
+static uint64_t encode_swar(const BenchData* d) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t sum = 0;
+    uint8_t codes[8];
+    for (uint32_t r = 0; r < d->reads.num_reads; r++) {
+        const char* seq = d->reads.bases + d->reads.offset[r];
+        uint32_t len = d->reads.offset[r + 1] - d->reads.offset[r];
+        uint64_t kmer = 0;
+        uint32_t run = 0;
+        uint32_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, seq + i, 8);
+            uint64_t valid = zero_bytes(w ^ (ones * 'A')) | zero_bytes(w ^ (ones * 'C')) |
+                             zero_bytes(w ^ (ones * 'G')) | zero_bytes(w ^ (ones * 'T'));
+            uint64_t code = ((w >> 1) ^ (w >> 2)) & (ones * 3);
+            // Invalid lanes become 4
+            code |= (~valid >> 5) & (ones * 4);
+            memcpy(codes, &code, 8);
+            sum += roll_codes(codes, 8, &kmer, &run);
+        }
+        for (; i < len; i++) {
+            codes[0] = BASE_TABLE[(uint8_t)seq[i]];
+            sum += roll_codes(codes, 1, &kmer, &run);
+        }
+    }
+    return sum;
+}
+
+#ifdef __SSE2__
+// SSE2: classify and code 16 upper-case bases per vector
+static uint64_t encode_sse2(const BenchData* d) {
+    const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G'), t = _mm_set1_epi8('T');
+    const __m128i three = _mm_set1_epi8(3), four = _mm_set1_epi8(4);
+    uint64_t sum = 0;
+    uint8_t codes[16];
+    for (uint32_t r = 0; r < d->reads.num_reads; r++) {
+        const char* seq = d->reads.bases + d->reads.offset[r];
+        uint32_t len = d->reads.offset[r + 1] - d->reads.offset[r];
+        uint64_t kmer = 0;
+        uint32_t run = 0;
+        uint32_t i = 0;
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(seq + i));
+            __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, c)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(v, g), _mm_cmpeq_epi8(v, t)));
+            __m128i code = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), three);
+            code = _mm_or_si128(code, _mm_andnot_si128(valid, four));
+            _mm_storeu_si128((__m128i*)codes, code);
+            sum += roll_codes(codes, 16, &kmer, &run);
+        }
+        for (; i < len; i++) {
+            codes[0] = BASE_TABLE[(uint8_t)seq[i]];
+            sum += roll_codes(codes, 1, &kmer, &run);
+        }
+    }
+    return sum;
+}
+#endif
+
+// ---- Hash table lookups ----
+
+static uint64_t lookup_read_kmers(const BenchData* d) {
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < d->num_kmers; i++) {
+        KmerEntry* entry = kmer_lookup(d->index, d->kmers[i]);
+        if (entry) found += entry->num_hits;
+    }
+    return found;
+}
+
+static uint64_t lookup_random_kmers(const BenchData* d) {
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < d->num_kmers; i++) {
+        KmerEntry* entry = kmer_lookup(d->index, d->random_kmers[i]);
+        if (entry) found += entry->num_hits;
+    }
+    return found;
+}
+
+// ---- FASTQ record splitting: total sequence length ----
+
+static uint64_t parse_fastq_next(const BenchData* d) {
+    static char sequence[READ_CACHE_MAX_LENGTH * 64];
+    static char quality[READ_CACHE_MAX_LENGTH * 64];
+    FastqRecord rec;
+    size_t pos = 0;
+    uint64_t bases = 0;
+    while (fastq_next(d->fastq, d->fastq_size, &pos, sequence, quality, sizeof(sequence), &rec)) {
+        bases += rec.seq_len;
+    }
+    return bases;
+}
+
+// Lower bound: find the four lines of each record with memchr, no copying
+static uint64_t parse_memchr(const BenchData* d) {
+    const char* p = d->fastq;
+    const char* end = d->fastq + d->fastq_size;
+    uint64_t bases = 0;
+    while (p < end) {
+        const char* line_end[4];
+        for (int l = 0; l < 4; l++) {
+            const char* nl = (const char*)memchr(p, '\n', end - p);
+            line_end[l] = nl ? nl : end;
+            if (l == 1) bases += line_end[1] - p;
+            p = line_end[l] + 1;
+            if (p >= end) break;
+        }
+    }
+    return bases;
+}
+
+// ---- TSV formatting: bytes written ----
+
+static void discard_output(const char* data, size_t size, void* user_data) {
+    (void)data;
+    *(uint64_t*)user_data += size;
+}
+
+static uint64_t format_tsv_writer(const BenchData* d) {
+    static TsvWriter writer;
+    uint64_t bytes = 0;
+    tsv_writer_init(&writer, discard_output, &bytes);
+    tsv_writer_rows(&writer, &d->rows, d->index);
+    tsv_writer_flush(&writer);
+    return bytes;
+}
+
+static uint64_t format_snprintf(const BenchData* d) {
+    static TsvWriter writer;
+    uint64_t bytes = 0;
+    char row[1024];
+    tsv_writer_init(&writer, discard_output, &bytes);
+    const ResultBuffer* rows = &d->rows;
+    for (uint32_t i = 0; i < rows->count; i++) {
+        const char* gene = rows->gene_id[i] == UINT32_MAX ? "No_hit" : index_gene_name(d->index, rows->gene_id[i]);
+        int n = snprintf(row, sizeof(row), "%.*s\t%s\t%u\t%.4f\t%.4f\n", (int)rows->name_length[i],
+                         rows->source + rows->name_offset[i], gene, rows->score[i],
+                         rows->coverage[i], rows->identity[i]);
+        if (n > 0) tsv_writer_write(&writer, row, (size_t)n < sizeof(row) ? (size_t)n : sizeof(row) - 1);
+    }
+    tsv_writer_flush(&writer);
+    return bytes;
+}
+
+typedef struct {
+    const char* kernel;
+    const char* variant;
+    KernelFn fn;
+    const char* unit;   // What per-unit timings are divided by
+} Kernel;
+
+static const Kernel KERNELS[] = {
+    {"encode", "scalar", encode_scalar, "base"},
+    {"encode", "rolling", encode_rolling, "base"},
+    {"encode", "rolling-table", encode_rolling_table, "base"},
+    {"encode", "swar", encode_swar, "base"},
+#ifdef __SSE2__
+    {"encode", "sse2", encode_sse2, "base"},
+#endif
+    {"lookup", "read-kmers", lookup_read_kmers, "lookup"},
+    {"lookup", "random-kmers", lookup_random_kmers, "lookup"},
+    {"parse", "fastq_next", parse_fastq_next, "byte"},
+    {"parse", "memchr", parse_memchr, "byte"},
+    {"format", "tsv_writer", format_tsv_writer, "row"},
+    {"format", "snprintf", format_snprintf, "row"},
+};
+#define NUM_KERNELS (sizeof(KERNELS) / sizeof(KERNELS[0]))
+
+static uint64_t kernel_units(const Kernel* k, const BenchData* d) {
+    if (strcmp(k->unit, "base") == 0) return d->reads.offset[d->reads.num_reads];
+    if (strcmp(k->unit, "lookup") == 0) return d->num_kmers;
+    if (strcmp(k->unit, "byte") == 0) return d->fastq_size;
+    return d->rows.count;
+}
+
+static int read_set_init(ReadSet* reads, const char* fastq, size_t fastq_size, uint32_t max_reads) {
+    char sequence[4096];
+    FastqRecord rec;
+    size_t pos = 0;
+    reads->bases = (char*)malloc(fastq_size + 1);
+    reads->offset = (uint32_t*)malloc(((size_t)max_reads + 1) * sizeof(uint32_t));
+    reads->num_reads = 0;
+    if (!reads->bases || !reads->offset) return -1;
+
+    uint32_t total = 0;
+    while (reads->num_reads < max_reads &&
+           fastq_next(fastq, fastq_size, &pos, sequence, NULL, sizeof(sequence), &rec)) {
+        reads->offset[reads->num_reads++] = total;
+        memcpy(reads->bases + total, sequence, rec.seq_len);
+        total += rec.seq_len;
+    }
+    reads->offset[reads->num_reads] = total;
+    return 0;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] <database.fasta>\n", prog);
+    printf("  --reads N           Synthetic reads (default: 100000)\n");
+    printf("  --length L          Read length (default: 150)\n");
+    printf("  --repeat R          Passes per kernel; the fastest is reported (default: 5)\n");
+    printf("  --kernel NAME       Run only kernels named NAME (encode, lookup, parse, format)\n");
+}
+
+int main(int argc, char** argv) {
+    SimOptions sim;
+    sim_options_default(&sim);
+    int repeat = 5;
+    const char* only = NULL;
+    const char* db_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--reads") == 0 && i + 1 < argc) {
+            sim.num_reads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--length") == 0 && i + 1 < argc) {
+            sim.read_length = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(arg, "--kernel") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            db_path = arg;
+        }
+    }
+    if (!db_path || repeat < 1 || sim.read_length == 0 || sim.read_length > 4000) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    size_t fasta_size;
+    char* fasta = harness_read_file(db_path, &fasta_size);
+    if (!fasta) {
+        printf("ERROR: Cannot open FASTA file\n");
+        return 1;
+    }
+
+    BenchData d;
+    memset(&d, 0, sizeof(d));
+    d.index = index_create(NULL);
+    if (!d.index || index_build_from_fasta(d.index, fasta, fasta_size) <= 0) {
+        printf("ERROR: Failed to build index\n");
+        return 1;
+    }
+    index_finalize(d.index);
+    free(fasta);
+
+    d.fastq = simulate_reads(d.index, &sim, &d.fastq_size, NULL);
+    if (!d.fastq || read_set_init(&d.reads, d.fastq, d.fastq_size, sim.num_reads) < 0) {
+        printf("ERROR: Failed to generate reads\n");
+        return 1;
+    }
+
+    // Lookup inputs: the read k-mers, and as many random ones
+    base_table_init();
+    uint64_t total_bases = d.reads.offset[d.reads.num_reads];
+    d.kmers = (uint64_t*)malloc((total_bases + 1) * sizeof(uint64_t));
+    d.random_kmers = (uint64_t*)malloc((total_bases + 1) * sizeof(uint64_t));
+    if (!d.kmers || !d.random_kmers) {
+        printf("ERROR: Out of memory\n");
+        return 1;
+    }
+    for (uint32_t r = 0; r < d.reads.num_reads; r++) {
+        const char* seq = d.reads.bases + d.reads.offset[r];
+        uint32_t len = d.reads.offset[r + 1] - d.reads.offset[r];
+        for (uint32_t i = 0; i + KMER_SIZE <= len; i++) {
+            if (kmer_is_valid(seq + i)) d.kmers[d.num_kmers++] = kmer_encode(seq + i);
+        }
+    }
+    uint64_t state = sim.seed;
+    for (uint64_t i = 0; i < d.num_kmers; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        d.random_kmers[i] = (state >> 11) & KMER_MASK;
+    }
+
+    // Formatting input: the real alignment rows
+    AlignOptions align_opts;
+    align_options_default(&align_opts);
+    if (align_fastq(d.index, &align_opts, d.fastq, d.fastq_size, &d.rows, NULL) < 0) {
+        printf("ERROR: Alignment failed\n");
+        return 1;
+    }
+
+    printf("# %u reads x %u bp, %llu bases, %llu k-mers, %.1f MB FASTQ, best of %d passes%s\n",
+           d.reads.num_reads, sim.read_length, (unsigned long long)total_bases,
+           (unsigned long long)d.num_kmers, d.fastq_size / 1048576.0, repeat,
+#ifdef HAVE_CYCLE_COUNTER
+           ""
+#else
+           "; no cycle counter on this target"
+#endif
+    );
+    printf("kernel\tvariant\tunit\tns_per_unit\tcycles_per_unit\tchecksum\n");
+
+    const char* last_kernel = NULL;
+    uint64_t reference = 0;
+    for (size_t k = 0; k < NUM_KERNELS; k++) {
+        const Kernel* kernel = &KERNELS[k];
+        if (only && strcmp(only, kernel->kernel) != 0) continue;
+
+        double best_seconds = 0;
+        uint64_t best_cycles = 0, checksum = 0;
+        for (int r = 0; r < repeat; r++) {
+            double t0 = harness_now_seconds();
+            uint64_t c0 = cycles_now();
+            checksum = kernel->fn(&d);
+            uint64_t cycles = cycles_now() - c0;
+            double seconds = harness_now_seconds() - t0;
+            if (r == 0 || seconds < best_seconds) best_seconds = seconds;
+            if (r == 0 || cycles < best_cycles) best_cycles = cycles;
+        }
+
+        // Variants of one kernel must agree with the first
+        int mismatch = 0;
+        if (!last_kernel || strcmp(last_kernel, kernel->kernel) != 0) {
+            last_kernel = kernel->kernel;
+            reference = checksum;
+        } else if (strcmp(kernel->kernel, "lookup") != 0 && checksum != reference) {
+            mismatch = 1;
+        }
+
+        uint64_t units = kernel_units(kernel, &d);
+        printf("%s\t%s\t%s\t%.3f\t", kernel->kernel, kernel->variant, kernel->unit,
+               units ? best_seconds * 1e9 / units : 0.0);
+#ifdef HAVE_CYCLE_COUNTER
+        printf("%.3f", units ? (double)best_cycles / units : 0.0);
+#else
+        printf("-");
+#endif
+        printf("\t%016llx%s\n", (unsigned long long)checksum, mismatch ? "\tMISMATCH" : "");
+    }
+
+    result_buffer_free(&d.rows);
+    free(d.kmers);
+    free(d.random_kmers);
+    free(d.reads.bases);
+    free(d.reads.offset);
+    free((char*)d.fastq);
+    index_destroy(d.index);
+    return 0;
+}
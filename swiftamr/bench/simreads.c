@@ -0,0 +1,105 @@
+#include "simreads.h"
+
+static const char BASES[4] = {'A', 'C', 'G', 'T'};
+
+// splitmix64: small, seedable and the same on every platform
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform double in [0, 1)
+static double next_unit(uint64_t* state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void sim_options_default(SimOptions* opts) {
+    opts->num_reads = 100000;
+    opts->read_length = 150;
+    opts->error_rate = 0.01;
+    opts->reverse_fraction = 0.5;
+    opts->offtarget_fraction = 0.1;
+    opts->seed = 1;
+}
+
+char* simulate_reads(const KmerIndex* index, const SimOptions* opts, size_t* fastq_size, SimTruth* truth) {
+    if (index->num_genes == 0 || opts->read_length == 0) return NULL;
+
+    // Cumulative gene lengths for length-weighted gene choice
+    uint64_t* cumulative = (uint64_t*)malloc(index->num_genes * sizeof(uint64_t));
+    char* read = (char*)malloc(opts->read_length + 1);
+    size_t capacity = (size_t)opts->num_reads * (2 * opts->read_length + MAX_GENE_NAME + 64) + 1;
+    char* fastq = (char*)malloc(capacity);
+    if (!cumulative || !read || !fastq) {
+        free(cumulative);
+        free(read);
+        free(fastq);
+        return NULL;
+    }
+
+    uint64_t total_bases = 0;
+    for (uint32_t g = 0; g < index->num_genes; g++) {
+        total_bases += index->genes[g].length;
+        cumulative[g] = total_bases;
+    }
+
+    uint64_t state = opts->seed;
+    size_t used = 0;
+    for (uint32_t r = 0; r < opts->num_reads; r++) {
+        SimTruth t = {SIM_OFF_TARGET, 0, 0};
+        uint32_t length = opts->read_length;
+
+        if (total_bases == 0 || next_unit(&state) < opts->offtarget_fraction) {
+            for (uint32_t i = 0; i < length; i++) read[i] = BASES[next_random(&state) & 3];
+        } else {
+            uint64_t base = next_random(&state) % total_bases;
+            uint32_t lo = 0, hi = index->num_genes - 1;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (cumulative[mid] > base) hi = mid; else lo = mid + 1;
+            }
+            t.gene_id = lo;
+
+            uint32_t gene_length = index->genes[lo].length;
+            if (length > gene_length) length = gene_length;
+            t.position = (uint32_t)(next_random(&state) % (gene_length - length + 1));
+            t.reverse = next_unit(&state) < opts->reverse_fraction;
+
+            for (uint32_t i = 0; i < length; i++) {
+                int nt = index_gene_base(index, lo, t.position + i);
+                char c = nt < 0 ? 'N' : BASES[nt];
+                if (t.reverse) {
+                    read[length - 1 - i] = nt < 0 ? 'N' : BASES[3 - nt];
+                } else {
+                    read[i] = c;
+                }
+            }
+        }
+
+        // Substitutions to a different base
+        for (uint32_t i = 0; i < length; i++) {
+            if (read[i] != 'N' && next_unit(&state) < opts->error_rate) {
+                int nt = read[i] == 'A' ? 0 : read[i] == 'C' ? 1 : read[i] == 'G' ? 2 : 3;
+                read[i] = BASES[(nt + 1 + next_random(&state) % 3) & 3];
+            }
+        }
+        read[length] = '\0';
+
+        const char* gene_name = t.gene_id == SIM_OFF_TARGET ? "none" : index_gene_name(index, t.gene_id);
+        used += snprintf(fastq + used, capacity - used, "@sim_%u gene=%.*s pos=%u strand=%c\n%s\n+\n",
+                         r, MAX_GENE_NAME, gene_name, t.position, t.reverse ? '-' : '+', read);
+        memset(fastq + used, 'I', length);
+        used += length;
+        fastq[used++] = '\n';
+
+        if (truth) truth[r] = t;
+    }
+    fastq[used] = '\0';
+
+    free(cumulative);
+    free(read);
+    *fastq_size = used;
+    return fastq;
+}
@@ -0,0 +1,33 @@
+#ifndef SIMREADS_H
+#define SIMREADS_H
+
+#include "swiftamr.h"
+
+#define SIM_OFF_TARGET UINT32_MAX // SimTruth.gene_id of a random read
+
+// Synthetic read set. The same options and seed always give the same reads.
+typedef struct {
+    uint32_t num_reads;
+    uint32_t read_length;      // Shorter genes give whole-gene reads
+    double error_rate;         // Per-base substitution probability
+    double reverse_fraction;   // Reads taken from the reverse strand
+    double offtarget_fraction; // Random reads that match no gene
+    uint64_t seed;
+} SimOptions;
+
+// Where each read came from
+typedef struct {
+    uint32_t gene_id;   // SIM_OFF_TARGET for random reads
+    uint32_t position;  // First gene base covered by the read
+    uint8_t reverse;    // Read is the reverse complement of the gene
+} SimTruth;
+
+void sim_options_default(SimOptions* opts);
+
+// Generate reads from the genes in index (genes are drawn in proportion to
+// their length) as a FASTQ buffer. Each header carries the truth as
+// "@sim_<i> gene=<name> pos=<position> strand=<+|->". truth, if not NULL,
+// receives num_reads entries. Returns a malloc'd buffer or NULL.
+char* simulate_reads(const KmerIndex* index, const SimOptions* opts, size_t* fastq_size, SimTruth* truth);
+
+#endif // SIMREADS_H
@@ -0,0 +1,125 @@
+#include "swiftamr.h"
+
+// Heap order for the top-N selection: fewer hits first, ties broken by k-mer
+// value so the report does not depend on table layout
+static int promiscuous_less(const PromiscuousKmer* a, const PromiscuousKmer* b) {
+    if (a->entry->num_hits != b->entry->num_hits) return a->entry->num_hits < b->entry->num_hits;
+    return a->entry->kmer > b->entry->kmer;
+}
+
+static void heap_sift_down(PromiscuousKmer* heap, uint32_t count, uint32_t i) {
+    for (;;) {
+        uint32_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < count && promiscuous_less(&heap[left], &heap[smallest])) smallest = left;
+        if (right < count && promiscuous_less(&heap[right], &heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        PromiscuousKmer tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void heap_sift_up(PromiscuousKmer* heap, uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!promiscuous_less(&heap[i], &heap[parent])) return;
+        PromiscuousKmer tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+// Index of the highest set bit (value > 0)
+static inline uint32_t log2_floor(uint32_t value) {
+    return 31 - (uint32_t)__builtin_clz(value);
+}
+
+// Walk every bucket and hit list of index. Hit lists are in gene order (genes
+// are indexed one after another), so distinct genes are counted by comparing
+// neighbours. Returns 0, or -1 if out of memory; free with
+// index_diagnostics_free either way.
+int index_diagnostics(const KmerIndex* index, uint32_t top_n, IndexDiagnostics* diag) {
+    memset(diag, 0, sizeof(*diag));
+    diag->table_size = index->table_size;
+    diag->gene_kmers = (uint32_t*)calloc(index->num_genes ? index->num_genes : 1, sizeof(uint32_t));
+    diag->gene_unique_kmers = (uint32_t*)calloc(index->num_genes ? index->num_genes : 1, sizeof(uint32_t));
+    diag->top = (PromiscuousKmer*)malloc((top_n ? top_n : 1) * sizeof(PromiscuousKmer));
+    if (!diag->gene_kmers || !diag->gene_unique_kmers || !diag->top) return -1;
+
+    uint64_t probes_found = 0;
+    for (uint32_t b = 0; b < index->table_size; b++) {
+        uint32_t chain = 0;
+        for (const KmerEntry* entry = index->table[b]; entry; entry = entry->next) {
+            chain++;
+            probes_found += chain;
+            diag->total_hits += entry->num_hits;
+            if (entry->num_hits > diag->longest_hit_list) diag->longest_hit_list = entry->num_hits;
+            if (entry->num_hits == 0) continue;
+
+            uint32_t bin = log2_floor(entry->num_hits);
+            diag->hits_histogram[bin < DIAG_HISTOGRAM_BINS ? bin : DIAG_HISTOGRAM_BINS - 1]++;
+
+            uint32_t num_genes = 0, last_gene = UINT32_MAX;
+            for (uint32_t h = 0; h < entry->num_hits; h++) {
+                uint32_t gene_id = entry->hits[h].gene_id;
+                if (gene_id >= index->num_genes) continue;
+                diag->gene_kmers[gene_id]++;
+                if (gene_id != last_gene) {
+                    num_genes++;
+                    last_gene = gene_id;
+                }
+            }
+            if (num_genes == 1) {
+                diag->single_gene_kmers++;
+                diag->gene_unique_kmers[last_gene]++;
+            }
+
+            if (top_n == 0) continue;
+            PromiscuousKmer candidate = {entry, num_genes};
+            if (diag->num_top < top_n) {
+                diag->top[diag->num_top] = candidate;
+                heap_sift_up(diag->top, diag->num_top++);
+            } else if (promiscuous_less(&diag->top[0], &candidate)) {
+                diag->top[0] = candidate;
+                heap_sift_down(diag->top, diag->num_top, 0);
+            }
+        }
+
+        diag->distinct_kmers += chain;
+        if (chain) diag->used_buckets++;
+        if (chain > diag->longest_chain) diag->longest_chain = chain;
+        diag->chain_histogram[chain < DIAG_HISTOGRAM_BINS ? chain : DIAG_HISTOGRAM_BINS - 1]++;
+    }
+
+    // Heap to descending order: repeatedly move the smallest to the end
+    for (uint32_t n = diag->num_top; n > 1; n--) {
+        PromiscuousKmer tmp = diag->top[0];
+        diag->top[0] = diag->top[n - 1];
+        diag->top[n - 1] = tmp;
+        heap_sift_down(diag->top, n - 1, 0);
+    }
+
+    diag->load_factor = index->table_size ? (double)diag->distinct_kmers / index->table_size : 0.0;
+    diag->mean_probes_found = diag->distinct_kmers ? (double)probes_found / diag->distinct_kmers : 0.0;
+
+    diag->table_bytes = (uint64_t)index->table_size * sizeof(KmerEntry*);
+    diag->entry_bytes = index->entry_arena.bytes_allocated;
+    diag->hit_bytes = index->hit_pool_size * sizeof(KmerHit) + index->hit_arena.bytes_allocated;
+    diag->sequence_bytes = index->seq_arena_words * sizeof(uint64_t) + (index->hit_counts ? index->seq_arena_bases : 0);
+    diag->n_run_bytes = (uint64_t)index->n_runs_capacity * sizeof(NRun);
+    diag->gene_bytes = (uint64_t)index->genes_capacity * sizeof(Gene);
+    diag->name_bytes = index->name_pool_capacity;
+    return 0;
+}
+
+void index_diagnostics_free(IndexDiagnostics* diag) {
+    free(diag->top);
+    free(diag->gene_kmers);
+    free(diag->gene_unique_kmers);
+    diag->top = NULL;
+    diag->gene_kmers = NULL;
+    diag->gene_unique_kmers = NULL;
+    diag->num_top = 0;
+}
@@ -0,0 +1,396 @@
+#define _POSIX_C_SOURCE 200809L
+#include "swiftamr.h"
+#include <errno.h>
+#include <sys/stat.h>
+
+// Serialized index layout (native byte order; the struct sizes in the header
+// reject files written by an incompatible build):
+//
+//   char     magic[4] = "SAMI"
+//   uint32_t version, kmer_size
+//   uint32_t sizeof Gene, KmerHit, NRun, IndexOptions, IndexStats
+//   uint64_t source_hash
+//   IndexOptions options
+//   IndexStats stats
+//   uint32_t num_genes, name_pool_size, num_n_runs, table_size
+//   uint64_t seq_arena_bases, hit_pool_size, num_entries
+//   Gene     genes[num_genes]
+//   char     name_pool[name_pool_size]
+//   uint64_t seq_arena[PACKED_WORDS(seq_arena_bases) + 1]
+//   uint8_t  hit_counts[seq_arena_bases]
+//   NRun     n_runs[num_n_runs]
+//   KmerHit  hit_pool[hit_pool_size]
+//   { uint64_t kmer, hit_offset; uint32_t num_hits; } entries[num_entries]
+//   uint64_t checksum (hash_bytes of everything before it)
+
+#define INDEX_FILE_MAGIC "SAMI"
+#define INDEX_FILE_VERSION 2
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} ByteWriter;
+
+static void put(ByteWriter* w, const void* data, size_t size) {
+    if (w->failed || size == 0) return;
+    if (w->size + size > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 4096;
+        while (w->size + size > capacity) capacity *= 2;
+        uint8_t* grown = (uint8_t*)realloc(w->data, capacity);
+        if (!grown) {
+            w->failed = 1;
+            return;
+        }
+        w->data = grown;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+static void put_u32(ByteWriter* w, uint32_t value) { put(w, &value, sizeof(value)); }
+static void put_u64(ByteWriter* w, uint64_t value) { put(w, &value, sizeof(value)); }
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+} ByteReader;
+
+// Copy size bytes to out; returns -1 past the end
+static int get(ByteReader* r, void* out, size_t size) {
+    if (size > r->size - r->pos) return -1;
+    if (size) memcpy(out, r->data + r->pos, size);
+    r->pos += size;
+    return 0;
+}
+
+static int get_u32(ByteReader* r, uint32_t* value) { return get(r, value, sizeof(*value)); }
+static int get_u64(ByteReader* r, uint64_t* value) { return get(r, value, sizeof(*value)); }
+
+// Allocate count elements of size bytes and fill them from r
+static void* get_array(ByteReader* r, uint64_t count, size_t size) {
+    if (count > (r->size - r->pos) / size) return NULL;
+    void* out = malloc(count ? count * size : 1);
+    if (out) get(r, out, count * size);
+    return out;
+}
+
+// Serialize a finalized index into a malloc'd buffer. Returns NULL if the
+// index has not been finalized or memory runs out.
+uint8_t* index_serialize(const KmerIndex* index, size_t* size) {
+    if (index->hit_arena.head || !index->hit_counts) return NULL; // Not (fully) finalized
+
+    ByteWriter w = {NULL, 0, 0, 0};
+    put(&w, INDEX_FILE_MAGIC, 4);
+    put_u32(&w, INDEX_FILE_VERSION);
+    put_u32(&w, KMER_SIZE);
+    put_u32(&w, sizeof(Gene));
+    put_u32(&w, sizeof(KmerHit));
+    put_u32(&w, sizeof(NRun));
+    put_u32(&w, sizeof(IndexOptions));
+    put_u32(&w, sizeof(IndexStats));
+    put_u64(&w, index->source_hash);
+    put(&w, &index->options, sizeof(IndexOptions));
+    put(&w, &index->stats, sizeof(IndexStats));
+    put_u32(&w, index->num_genes);
+    put_u32(&w, index->name_pool_size);
+    put_u32(&w, index->num_n_runs);
+    put_u32(&w, index->table_size);
+    put_u64(&w, index->seq_arena_bases);
+    put_u64(&w, index->hit_pool_size);
+    put_u64(&w, index->stats.distinct_kmers);
+
+    put(&w, index->genes, index->num_genes * sizeof(Gene));
+    put(&w, index->name_pool, index->name_pool_size);
+    if (index->seq_arena) {
+        put(&w, index->seq_arena, (PACKED_WORDS(index->seq_arena_bases) + 1) * sizeof(uint64_t));
+    } else {
+        put_u64(&w, 0);
+    }
+    put(&w, index->hit_counts, index->seq_arena_bases);
+    put(&w, index->n_runs, index->num_n_runs * sizeof(NRun));
+    put(&w, index->hit_pool, index->hit_pool_size * sizeof(KmerHit));
+
+    uint64_t num_entries = 0;
+    for (uint32_t i = 0; i < index->table_size; i++) {
+        for (const KmerEntry* entry = index->table[i]; entry; entry = entry->next) {
+            put_u64(&w, entry->kmer);
+            put_u64(&w, entry->num_hits ? (uint64_t)(entry->hits - index->hit_pool) : 0);
+            put_u32(&w, entry->num_hits);
+            num_entries++;
+        }
+    }
+
+    if (!w.failed && num_entries != index->stats.distinct_kmers) w.failed = 1;
+    if (!w.failed) put_u64(&w, hash_bytes(w.data, w.size, 0));
+    if (w.failed) {
+        free(w.data);
+        return NULL;
+    }
+    *size = w.size;
+    return w.data;
+}
+
+// Check that every gene's name, sequence and N runs, and every hit, lie
+// inside the pools they index, so a corrupt file cannot cause reads out of
+// bounds. Returns -1 on the first violation.
+static int index_check_pools(const KmerIndex* index) {
+    for (uint32_t g = 0; g < index->num_genes; g++) {
+        const Gene* gene = &index->genes[g];
+        if ((uint64_t)gene->name_offset + gene->name_length >= index->name_pool_size ||
+            index->name_pool[gene->name_offset + gene->name_length] != '\0' ||
+            gene->seq_offset > index->seq_arena_bases ||
+            gene->length > index->seq_arena_bases - gene->seq_offset ||
+            (uint64_t)gene->n_runs_start + gene->n_runs_count > index->num_n_runs) {
+            return -1;
+        }
+        for (uint32_t r = 0; r < gene->n_runs_count; r++) {
+            const NRun* run = &index->n_runs[gene->n_runs_start + r];
+            if ((uint64_t)run->start + run->length > gene->length) return -1;
+        }
+    }
+    for (uint64_t h = 0; h < index->hit_pool_size; h++) {
+        const KmerHit* hit = &index->hit_pool[h];
+        if (hit->gene_id >= index->num_genes ||
+            (uint64_t)hit->position + KMER_SIZE > index->genes[hit->gene_id].length) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Rebuild an index from index_serialize output. Returns NULL if the data is
+// truncated, corrupted or from an incompatible build.
+KmerIndex* index_deserialize(const uint8_t* data, size_t size) {
+    if (size < 12) return NULL;
+    uint64_t checksum;
+    memcpy(&checksum, data + size - 8, 8);
+    if (checksum != hash_bytes(data, size - 8, 0)) return NULL;
+
+    ByteReader r = {data, size - 8, 0};
+    char magic[4];
+    uint32_t header[7];
+    if (get(&r, magic, 4) < 0 || memcmp(magic, INDEX_FILE_MAGIC, 4) != 0) return NULL;
+    for (int i = 0; i < 7; i++) {
+        if (get_u32(&r, &header[i]) < 0) return NULL;
+    }
+    uint32_t expected[7] = {INDEX_FILE_VERSION, KMER_SIZE, sizeof(Gene), sizeof(KmerHit),
+                            sizeof(NRun), sizeof(IndexOptions), sizeof(IndexStats)};
+    if (memcmp(header, expected, sizeof(header)) != 0) return NULL;
+
+    uint64_t source_hash;
+    IndexOptions options;
+    IndexStats stats;
+    uint32_t num_genes, name_pool_size, num_n_runs, table_size;
+    uint64_t seq_arena_bases, hit_pool_size, num_entries;
+    if (get_u64(&r, &source_hash) < 0 || get(&r, &options, sizeof(options)) < 0 ||
+        get(&r, &stats, sizeof(stats)) < 0 || get_u32(&r, &num_genes) < 0 ||
+        get_u32(&r, &name_pool_size) < 0 || get_u32(&r, &num_n_runs) < 0 ||
+        get_u32(&r, &table_size) < 0 || get_u64(&r, &seq_arena_bases) < 0 ||
+        get_u64(&r, &hit_pool_size) < 0 || get_u64(&r, &num_entries) < 0) {
+        return NULL;
+    }
+    if (table_size == 0 || (table_size & (table_size - 1)) || table_size > HASH_TABLE_MAX_SIZE) return NULL;
+
+    // Entries are read into one chain in bucket 0 of a default-sized table,
+    // then rehashed into table_size buckets
+    options.expected_kmers = 0;
+    KmerIndex* index = index_create(&options);
+    if (!index) return NULL;
+    index->source_hash = source_hash;
+    index->stats = stats;
+
+    free(index->genes);
+    index->genes = (Gene*)get_array(&r, num_genes, sizeof(Gene));
+    index->num_genes = index->genes_capacity = num_genes;
+    index->name_pool = (char*)get_array(&r, name_pool_size, 1);
+    index->name_pool_size = index->name_pool_capacity = name_pool_size;
+    index->seq_arena_words = PACKED_WORDS(seq_arena_bases) + 1;
+    index->seq_arena = (uint64_t*)get_array(&r, index->seq_arena_words, sizeof(uint64_t));
+    index->seq_arena_bases = seq_arena_bases;
+    index->hit_counts = (uint8_t*)get_array(&r, seq_arena_bases, 1);
+    index->n_runs = (NRun*)get_array(&r, num_n_runs, sizeof(NRun));
+    index->num_n_runs = index->n_runs_capacity = num_n_runs;
+    index->hit_pool = (KmerHit*)get_array(&r, hit_pool_size, sizeof(KmerHit));
+    index->hit_pool_size = hit_pool_size;
+    if (!index->genes || !index->name_pool || !index->seq_arena || !index->hit_counts || !index->n_runs ||
+        !index->hit_pool || num_entries != stats.distinct_kmers || index_check_pools(index) < 0) {
+        index_destroy(index);
+        return NULL;
+    }
+
+    KmerEntry* chain = NULL;
+    for (uint64_t e = 0; e < num_entries; e++) {
+        uint64_t kmer, hit_offset;
+        uint32_t num_hits;
+        KmerEntry* entry = (KmerEntry*)arena_alloc(&index->entry_arena, sizeof(KmerEntry));
+        if (!entry || get_u64(&r, &kmer) < 0 || get_u64(&r, &hit_offset) < 0 ||
+            get_u32(&r, &num_hits) < 0 || hit_offset > hit_pool_size ||
+            num_hits > hit_pool_size - hit_offset) {
+            index_destroy(index);
+            return NULL;
+        }
+        entry->kmer = kmer;
+        entry->hits = index->hit_pool + hit_offset;
+        entry->num_hits = entry->capacity = num_hits;
+        entry->next = chain;
+        chain = entry;
+    }
+
+    index->table[0] = chain;
+    if (r.pos != r.size || index_resize_table(index, table_size) < 0) {
+        index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Read a whole file into a malloc'd buffer; -1 if it cannot be read
+static int read_whole_file(const char* path, uint8_t** data, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* buffer = length >= 0 ? (uint8_t*)malloc(length ? length : 1) : NULL;
+    if (!buffer || fread(buffer, 1, length, file) != (size_t)length) {
+        free(buffer);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    *data = buffer;
+    *size = length;
+    return 0;
+}
+
+// Write a file through a temporary name, so readers never see a partial file
+static int write_whole_file(const char* path, const uint8_t* data, size_t size) {
+    size_t path_length = strlen(path);
+    char* tmp_path = (char*)malloc(path_length + 5);
+    if (!tmp_path) return -1;
+    memcpy(tmp_path, path, path_length);
+    memcpy(tmp_path + path_length, ".tmp", 5);
+
+    FILE* file = fopen(tmp_path, "wb");
+    int ret = file ? 0 : -1;
+    if (file) {
+        if (fwrite(data, 1, size, file) != size) ret = -1;
+        if (fclose(file) != 0) ret = -1;
+        if (ret == 0 && rename(tmp_path, path) != 0) ret = -1;
+        if (ret < 0) remove(tmp_path);
+    }
+    free(tmp_path);
+    return ret;
+}
+
+int index_save(KmerIndex* index, const char* filename) {
+    size_t size;
+    uint8_t* data = index_serialize(index, &size);
+    if (!data) return -1;
+    int ret = write_whole_file(filename, data, size);
+    free(data);
+    return ret;
+}
+
+KmerIndex* index_load(const char* filename) {
+    uint8_t* data;
+    size_t size;
+    if (read_whole_file(filename, &data, &size) < 0) return NULL;
+    KmerIndex* index = index_deserialize(data, size);
+    free(data);
+    return index;
+}
+
+// Storage key of a serialized index: content hash and k-mer size
+void index_cache_key(uint64_t source_hash, char* key, size_t key_size) {
+    snprintf(key, key_size, "swiftamr-%016llx-k%d.idx", (unsigned long long)source_hash, KMER_SIZE);
+}
+
+// Load the index cached for source_hash (see index_source_hash); NULL on a miss
+KmerIndex* index_cache_load(const IndexStorage* storage, uint64_t source_hash) {
+    char key[64];
+    uint8_t* data;
+    size_t size;
+    index_cache_key(source_hash, key, sizeof(key));
+    if (storage->read(storage->user_data, key, &data, &size) < 0) return NULL;
+
+    KmerIndex* index = index_deserialize(data, size);
+    free(data);
+    if (index && index->source_hash != source_hash) {
+        index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Serialize a finalized index into storage under its source hash
+int index_cache_store(const IndexStorage* storage, const KmerIndex* index) {
+    char key[64];
+    size_t size;
+    uint8_t* data = index_serialize(index, &size);
+    if (!data) return -1;
+    index_cache_key(index->source_hash, key, sizeof(key));
+    int ret = storage->write(storage->user_data, key, data, size);
+    free(data);
+    return ret;
+}
+
+// Directory backend: one file per key in the directory named by user_data
+static char* storage_path(const char* dir, const char* key) {
+    size_t dir_length = strlen(dir), key_length = strlen(key);
+    char* path = (char*)malloc(dir_length + key_length + 2);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, key, key_length + 1);
+    return path;
+}
+
+static int directory_read(void* user_data, const char* key, uint8_t** data, size_t* size) {
+    char* path = storage_path((const char*)user_data, key);
+    int ret = path ? read_whole_file(path, data, size) : -1;
+    free(path);
+    return ret;
+}
+
+// mkdir -p
+static int make_directories(const char* dir) {
+    char* path = strdup(dir);
+    if (!path) return -1;
+    for (char* p = path + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            free(path);
+            return -1;
+        }
+        if (c == '\0') break;
+        *p = c;
+    }
+    free(path);
+    return 0;
+}
+
+static int directory_write(void* user_data, const char* key, const uint8_t* data, size_t size) {
+    const char* dir = (const char*)user_data;
+    if (make_directories(dir) < 0) return -1;
+    char* path = storage_path(dir, key);
+    int ret = path ? write_whole_file(path, data, size) : -1;
+    free(path);
+    return ret;
+}
+
+// Storage that keeps each key as a file in dir (created on first write).
+// dir must outlive the storage.
+void index_storage_directory(IndexStorage* storage, const char* dir) {
+    storage->read = directory_read;
+    storage->write = directory_write;
+    storage->user_data = (void*)dir;
+}
@@ -1,178 +1,1247 @@
 #include "swiftamr.h"
+#include <signal.h>
+#include <stdarg.h>
+#ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#define MAX_INDEX_HANDLES 16
+
+// One loaded database and the state of its last alignment. Handle exports
+// only touch their own instance, so several databases can stay resident.
+typedef struct {
+    KmerIndex* index;
+    AlignStats last_align_stats;
+    uint8_t* output_data;   // Result bytes owned by the engine until released
+    size_t output_size;
+    char hash[17];          // index->source_hash in hex
+} IndexInstance;
+
+// Index handles are 1..MAX_INDEX_HANDLES; default_handle backs the exports
+// that take no handle (0 = none)
+static IndexInstance* instances[MAX_INDEX_HANDLES];
+static int default_handle = 0;
 
-// Global index
-static KmerIndex* global_index = NULL;
+// Options used by the next index build and by every alignment
+static IndexOptions global_index_options = {0, KMER_CAP_DROP, 0, DUST_THRESHOLD, 1, 0, 0};
+static AlignOptions global_align_options = {0, 0, 0, 1, NULL, NULL, PROGRESS_INTERVAL_READS, PROGRESS_INTERVAL_BYTES,
+                                            NULL, NULL};
+static PreviewOptions global_preview_options = {0, 0, PREVIEW_REL_TOLERANCE, PREVIEW_ABS_TOLERANCE,
+                                                PREVIEW_MIN_CHUNKS, PREVIEW_CHUNK_BYTES, 1};
 
-// WASM-exported function: Initialize index from FASTA data
+// Where built indexes are cached by source hash (read == NULL = no cache)
+static IndexStorage index_storage = {NULL, NULL, NULL};
+
+static IndexInstance* instance_get(int handle) {
+    if (handle < 1 || handle > MAX_INDEX_HANDLES) return NULL;
+    return instances[handle - 1];
+}
+
+// WASM-exported function: Set options used by the next swiftamr_build_index call
 EMSCRIPTEN_KEEPALIVE
-int swiftamr_build_index(const char* fasta_data, size_t fasta_size) {
-    if (global_index) {
-        index_destroy(global_index);
+void swiftamr_set_index_options(uint32_t max_kmer_hits, int cap_mode,
+                                uint32_t dust_window, float dust_threshold,
+                                uint32_t kmer_stride, uint32_t max_memory_mb) {
+    global_index_options.max_kmer_hits = max_kmer_hits;
+    global_index_options.cap_mode = cap_mode == KMER_CAP_TRUNCATE ? KMER_CAP_TRUNCATE : KMER_CAP_DROP;
+    global_index_options.dust_window = dust_window;
+    global_index_options.dust_threshold = dust_threshold;
+    global_index_options.kmer_stride = kmer_stride ? kmer_stride : 1;
+    global_index_options.max_memory = (uint64_t)max_memory_mb * 1024 * 1024;
+}
+
+// WASM-exported function: Set quality filters, read cache size and seed extension used by swiftamr_align_fastq
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_set_align_options(int min_base_quality, int min_mean_quality,
+                                uint32_t read_cache_entries, int seed_extend) {
+    global_align_options.min_base_quality = (uint8_t)min_base_quality;
+    global_align_options.min_mean_quality = (uint8_t)min_mean_quality;
+    global_align_options.read_cache_entries = read_cache_entries;
+    global_align_options.seed_extend = seed_extend;
+}
+
+// WASM-exported function: Set the budgets of preview alignments (OUTPUT_FORMAT_PREVIEW):
+// stop after max_seconds or max_reads (0 = no limit), or once every gene's
+// interval is within rel_tolerance of its estimate (0 = the default)
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_set_preview_options(double max_seconds, uint32_t max_reads, float rel_tolerance, uint32_t seed) {
+    global_preview_options.max_seconds = max_seconds;
+    global_preview_options.max_reads = max_reads;
+    global_preview_options.rel_tolerance = rel_tolerance > 0 ? rel_tolerance : PREVIEW_REL_TOLERANCE;
+    global_preview_options.seed = seed;
+}
+
+// Progress callback registered from JS (addFunction, signature 'vddddi'):
+// reads, bytes consumed, total bytes, reads/sec, done
+typedef void (*swiftamr_progress_fn)(double reads, double bytes, double total_bytes,
+                                     double reads_per_sec, int done);
+
+static void call_progress_fn(const AlignProgress* progress, void* user_data) {
+    swiftamr_progress_fn fn = *(swiftamr_progress_fn*)user_data;
+    fn((double)progress->reads, (double)progress->bytes, (double)progress->total_bytes,
+       progress->reads_per_sec, progress->done);
+}
+
+static swiftamr_progress_fn progress_fn = NULL;
+
+// WASM-exported function: Report alignment progress to callback every
+// every_reads reads or every_bytes FASTQ bytes (0 = that interval is off,
+// both 0 = the defaults), and once more when the call finishes.
+// Pass callback = 0 to stop reporting.
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_set_progress_callback(swiftamr_progress_fn callback, uint32_t every_reads, uint32_t every_bytes) {
+    progress_fn = callback;
+    global_align_options.progress = callback ? call_progress_fn : NULL;
+    global_align_options.progress_user_data = &progress_fn;
+    if (every_reads == 0 && every_bytes == 0) {
+        every_reads = PROGRESS_INTERVAL_READS;
+        every_bytes = PROGRESS_INTERVAL_BYTES;
+    }
+    global_align_options.progress_reads = every_reads;
+    global_align_options.progress_bytes = every_bytes;
+}
+
+// Cancel callback registered from JS (addFunction, signature 'i'). It runs on
+// the worker thread in the middle of an alignment, so it typically reads a
+// flag the page sets through a SharedArrayBuffer.
+typedef int (*swiftamr_cancel_fn)(void);
+
+static int call_cancel_fn(void* user_data) {
+    swiftamr_cancel_fn fn = *(swiftamr_cancel_fn*)user_data;
+    return fn();
+}
+
+static swiftamr_cancel_fn cancel_fn = NULL;
+
+// WASM-exported function: Poll callback every CANCEL_CHECK_READS reads during
+// alignment; once it returns nonzero the alignment stops, frees its working
+// buffers and returns the rows so far. The index stays loaded.
+// Pass callback = 0 to stop polling.
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_set_cancel_callback(swiftamr_cancel_fn callback) {
+    cancel_fn = callback;
+    global_align_options.cancel = callback ? call_cancel_fn : NULL;
+    global_align_options.cancel_user_data = &cancel_fn;
+}
+
+// WASM-exported function: Build an index from FASTA data with the current
+// index options. Returns a handle for the swiftamr_index_* exports, or -1.
+EMSCRIPTEN_KEEPALIVE
+int swiftamr_index_create(const char* fasta_data, size_t fasta_size) {
+    int slot = 0;
+    while (slot < MAX_INDEX_HANDLES && instances[slot]) slot++;
+    if (slot == MAX_INDEX_HANDLES) {
+        printf("ERROR: Too many indexes loaded (max %d)\n", MAX_INDEX_HANDLES);
+        return -1;
     }
 
-    global_index = index_create();
-    if (!global_index) {
+    IndexInstance* inst = (IndexInstance*)calloc(1, sizeof(IndexInstance));
+    if (!inst) {
         printf("ERROR: Failed to create index\n");
         return -1;
     }
 
-    printf("Building k-mer index from FASTA...\n");
-    int genes_added = index_build_from_fasta(global_index, fasta_data, fasta_size);
+    trace_begin("index_build", "bytes", fasta_size);
+    if (index_storage.read) {
+        uint64_t source_hash = index_source_hash(&global_index_options, fasta_data, fasta_size);
+        trace_begin("index_cache_load", NULL, 0);
+        inst->index = index_cache_load(&index_storage, source_hash);
+        trace_end("index_cache_load", "hit", inst->index != NULL);
+        if (inst->index) {
+            printf("Index loaded from cache: %u genes\n", inst->index->num_genes);
+        }
+    }
+
+    if (!inst->index) {
+        inst->index = index_create(&global_index_options);
+        if (!inst->index) {
+            printf("ERROR: Failed to create index\n");
+            free(inst);
+            trace_end("index_build", NULL, 0);
+            return -1;
+        }
+
+        printf("Building k-mer index from FASTA...\n");
+        int genes_added = index_build_from_fasta(inst->index, fasta_data, fasta_size);
+
+        if (genes_added < 0) {
+            if (global_index_options.max_memory > 0) {
+                printf("ERROR: Failed to build index within %llu MB\n",
+                       (unsigned long long)(global_index_options.max_memory >> 20));
+            } else {
+                printf("ERROR: Failed to build index\n");
+            }
+            index_destroy(inst->index);
+            free(inst);
+            trace_end("index_build", NULL, 0);
+            return -1;
+        }
+
+        index_finalize(inst->index);
+
+        printf("Index built successfully: %d genes, %u total genes in index\n",
+               genes_added, inst->index->num_genes);
+
+        // A failed store only costs a rebuild next time
+        if (index_storage.write) {
+            trace_begin("index_cache_store", NULL, 0);
+            if (index_cache_store(&index_storage, inst->index) < 0) {
+                printf("WARNING: Failed to cache index\n");
+            }
+            trace_end("index_cache_store", NULL, 0);
+        }
+    }
+    trace_end("index_build", "genes", inst->index->num_genes);
+    snprintf(inst->hash, sizeof(inst->hash), "%016llx", (unsigned long long)inst->index->source_hash);
+
+    instances[slot] = inst;
+    return slot + 1;
+}
+
+// WASM-exported function: Free an index handle and its output buffer
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_index_destroy(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    if (!inst) return;
+    index_destroy(inst->index);
+    free(inst->output_data);
+    free(inst);
+    instances[handle - 1] = NULL;
+    if (handle == default_handle) default_handle = 0;
+}
+
+// WASM-exported function: Content hash (hex) of the database an index handle
+// was built from, together with its index options
+EMSCRIPTEN_KEEPALIVE
+const char* swiftamr_index_hash(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    return inst ? inst->hash : "";
+}
+
+// WASM-exported function: Content hash (hex) that an index built now from
+// this FASTA would have. When it equals swiftamr_get_hash() the loaded index
+// can be reused instead of rebuilt. The caller frees the string.
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_database_hash(const char* fasta_data, size_t fasta_size) {
+    char* hash = (char*)malloc(17);
+    if (!hash) return NULL;
+    snprintf(hash, 17, "%016llx",
+             (unsigned long long)index_source_hash(&global_index_options, fasta_data, fasta_size));
+    return hash;
+}
+
+// WASM-exported function: Storage key under which the index for this FASTA
+// is cached (see swiftamr_set_index_storage). The caller frees the string.
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_database_cache_key(const char* fasta_data, size_t fasta_size) {
+    char* key = (char*)malloc(64);
+    if (!key) return NULL;
+    index_cache_key(index_source_hash(&global_index_options, fasta_data, fasta_size), key, 64);
+    return key;
+}
+
+// WASM-exported function: Cache built indexes through read/write callbacks
+// (function table pointers, see IndexStorage). Index builds first try read
+// with the database's cache key and write the index after building.
+// Pass read = 0 to disable the cache.
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_set_index_storage(int (*read_fn)(void*, const char*, uint8_t**, size_t*),
+                                int (*write_fn)(void*, const char*, const uint8_t*, size_t)) {
+    index_storage.read = read_fn;
+    index_storage.write = read_fn ? write_fn : NULL;
+    index_storage.user_data = NULL;
+}
 
-    if (genes_added < 0) {
-        printf("ERROR: Failed to build index\n");
-        index_destroy(global_index);
-        global_index = NULL;
+// WASM-exported function: Initialize index from FASTA data (replaces the
+// default index used by the exports without a handle)
+EMSCRIPTEN_KEEPALIVE
+int swiftamr_build_index(const char* fasta_data, size_t fasta_size) {
+    swiftamr_index_destroy(default_handle);
+
+    int handle = swiftamr_index_create(fasta_data, fasta_size);
+    if (handle < 0) return -1;
+    default_handle = handle;
+    return (int)instance_get(handle)->index->num_genes;
+}
+
+// Alignment output state shared by the exports below
+typedef struct {
+    TsvWriter writer;
+    uint32_t rows;
+    const KmerIndex* index;
+} AlignOutput;
+
+static void write_batch(const ResultBuffer* batch, void* user_data) {
+    AlignOutput* out = (AlignOutput*)user_data;
+    tsv_writer_rows(&out->writer, batch, out->index);
+    out->rows += batch->count;
+}
+
+// Log alignment totals and keep the stats for swiftamr_index_stats
+static void report_alignment(IndexInstance* inst, uint32_t rows, const AlignStats* align_stats) {
+    printf("Aligned %u reads\n", rows);
+    if (align_stats->cancelled) printf("Alignment cancelled: results are partial\n");
+    if (align_stats->reads_low_quality || align_stats->kmers_low_quality) {
+        printf("Quality filter: skipped %llu reads, %llu k-mers\n",
+               (unsigned long long)align_stats->reads_low_quality,
+               (unsigned long long)align_stats->kmers_low_quality);
+    }
+    if (align_stats->cache_lookups) {
+        printf("Read cache: %llu hits / %llu lookups (%.1f%%)\n",
+               (unsigned long long)align_stats->cache_hits,
+               (unsigned long long)align_stats->cache_lookups,
+               100.0 * align_stats->cache_hits / align_stats->cache_lookups);
+    }
+    inst->last_align_stats = *align_stats;
+}
+
+// FASTQ input of one run: single-end reads, R1/R2 mates, or interleaved
+// mates in r1 (paired with r2 NULL)
+typedef struct {
+    const char* r1;
+    size_t r1_size;
+    const char* r2;
+    size_t r2_size;
+    int paired;
+} FastqInput;
+
+static int align_input_stream(IndexInstance* inst, const FastqInput* in,
+                              ResultBatchCallback callback, void* user_data, AlignStats* align_stats) {
+    printf(in->paired ? "Aligning read pairs from FASTQ...\n" : "Aligning reads from FASTQ...\n");
+    if (in->paired) {
+        return align_fastq_pairs_stream(inst->index, &global_align_options, in->r1, in->r1_size,
+                                        in->r2, in->r2_size, callback, user_data, align_stats);
+    }
+    return align_fastq_stream(inst->index, &global_align_options, in->r1, in->r1_size,
+                              callback, user_data, align_stats);
+}
+
+// Align FASTQ data, streaming TSV rows through writer. Returns rows written or -1.
+static int align_to_writer(IndexInstance* inst, const FastqInput* in, AlignOutput* out) {
+    AlignStats align_stats = {0};
+    out->rows = 0;
+    out->index = inst->index;
+    tsv_writer_header(&out->writer);
+
+    int ret = align_input_stream(inst, in, write_batch, out, &align_stats);
+    trace_begin("output_flush", "bytes", out->writer.used);
+    tsv_writer_flush(&out->writer);
+    trace_end("output_flush", NULL, 0);
+
+    if (ret < 0) {
+        printf("ERROR: Alignment failed\n");
         return -1;
     }
 
-    printf("Index built successfully: %d genes, %u total genes in index\n",
-           genes_added, global_index->num_genes);
+    report_alignment(inst, out->rows, &align_stats);
+    return (int)out->rows;
+}
+
+// Align FASTQ data into per-gene totals and write the gene table through
+// writer. Returns the number of reads aligned or -1.
+static int summarize_to_writer(IndexInstance* inst, const FastqInput* in, TsvWriter* writer) {
+    printf(in->paired ? "Aligning read pairs from FASTQ (gene summary)...\n"
+                      : "Aligning reads from FASTQ (gene summary)...\n");
+
+    GeneSummary summary;
+    if (gene_summary_init(&summary, inst->index) < 0) {
+        printf("ERROR: Alignment failed\n");
+        return -1;
+    }
+
+    AlignStats align_stats = {0};
+    int ret = in->paired
+              ? align_fastq_pairs_summary(inst->index, &global_align_options, in->r1, in->r1_size,
+                                          in->r2, in->r2_size, &summary, &align_stats)
+              : align_fastq_summary(inst->index, &global_align_options, in->r1, in->r1_size,
+                                    &summary, &align_stats);
+    if (ret < 0) {
+        gene_summary_free(&summary);
+        printf("ERROR: Alignment failed\n");
+        return -1;
+    }
 
-    return genes_added;
+    trace_begin("output_flush", "genes", summary.num_genes);
+    tsv_writer_gene_summary(writer, &summary, inst->index);
+    tsv_writer_flush(writer);
+    trace_end("output_flush", NULL, 0);
+    report_alignment(inst, (uint32_t)ret, &align_stats);
+    printf("Reads with a hit: %llu\n", (unsigned long long)summary.reads_mapped);
+    gene_summary_free(&summary);
+    return ret;
 }
 
-// WASM-exported function: Align FASTQ reads
+// Estimate per-gene abundance from a random sample of FASTQ chunks and write
+// the preview table through writer. Paired input is previewed from the R1
+// file (interleaved mates as single reads). Returns the reads aligned or -1.
+static int preview_to_writer(IndexInstance* inst, const FastqInput* in, TsvWriter* writer) {
+    printf("Previewing reads from FASTQ...\n");
+    if (in->paired) printf("Preview uses single-end reads of the first FASTQ file\n");
+
+    GeneSummary summary;
+    GenePreview preview;
+    if (gene_summary_init(&summary, inst->index) < 0) {
+        printf("ERROR: Alignment failed\n");
+        return -1;
+    }
+
+    AlignStats align_stats = {0};
+    int ret = preview_fastq(inst->index, &global_align_options, &global_preview_options, in->r1, in->r1_size,
+                            &summary, &preview, &align_stats);
+    if (ret < 0) {
+        gene_preview_free(&preview);
+        gene_summary_free(&summary);
+        printf("ERROR: Alignment failed\n");
+        return -1;
+    }
+
+    trace_begin("output_flush", "genes", summary.num_genes);
+    tsv_writer_gene_preview(writer, &preview, &summary, inst->index);
+    tsv_writer_flush(writer);
+    trace_end("output_flush", NULL, 0);
+    report_alignment(inst, (uint32_t)ret, &align_stats);
+    char stopped[160];
+    preview_describe(&preview, stopped, sizeof(stopped));
+    printf("%s\n", stopped);
+    gene_preview_free(&preview);
+    gene_summary_free(&summary);
+    return ret;
+}
+
+// Growable string that collects writer chunks for swiftamr_align_fastq and
+// the JSON reports
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} StringSink;
+
+static void append_to_string(const char* data, size_t size, void* user_data) {
+    StringSink* sink = (StringSink*)user_data;
+    if (!sink->data) return;
+    if (sink->size + size + 1 > sink->capacity) {
+        size_t capacity = sink->capacity * 2;
+        while (sink->size + size + 1 > capacity) capacity *= 2;
+        char* grown = (char*)realloc(sink->data, capacity);
+        if (!grown) {
+            free(sink->data);
+            sink->data = NULL;
+            return;
+        }
+        sink->data = grown;
+        sink->capacity = capacity;
+    }
+    memcpy(sink->data + sink->size, data, size);
+    sink->size += size;
+    sink->data[sink->size] = '\0';
+}
+
+// WASM-exported function: Align FASTQ reads, returning the whole TSV as one string
 EMSCRIPTEN_KEEPALIVE
 char* swiftamr_align_fastq(const char* fastq_data, size_t fastq_size) {
-    if (!global_index) {
+    IndexInstance* inst = instance_get(default_handle);
+    if (!inst) {
         printf("ERROR: Index not initialized\n");
         return strdup("ERROR: Index not initialized");
     }
 
-    printf("Aligning reads from FASTQ...\n");
+    StringSink sink = {(char*)malloc(OUTPUT_CHUNK_SIZE), 0, OUTPUT_CHUNK_SIZE};
+    if (!sink.data) return strdup("ERROR: Alignment failed");
+    sink.data[0] = '\0';
 
-    ReadAlignment** results = NULL;
-    uint32_t num_results = 0;
+    AlignOutput* out = (AlignOutput*)malloc(sizeof(AlignOutput));
+    if (!out) {
+        free(sink.data);
+        return strdup("ERROR: Alignment failed");
+    }
+    tsv_writer_init(&out->writer, append_to_string, &sink);
 
-    int ret = align_fastq(global_index, fastq_data, fastq_size, &results, &num_results);
+    FastqInput in = {fastq_data, fastq_size, NULL, 0, 0};
+    int ret = align_to_writer(inst, &in, out);
+    free(out);
 
-    if (ret < 0) {
-        printf("ERROR: Alignment failed\n");
+    if (ret < 0 || !sink.data) {
+        free(sink.data);
         return strdup("ERROR: Alignment failed");
     }
+    return sink.data;
+}
 
-    printf("Aligned %u reads\n", num_results);
+// Output callback registered from JS (addFunction) or passed natively
+typedef void (*swiftamr_output_fn)(const char* data, size_t size);
 
-    // Generate TSV output
-    size_t buffer_size = num_results * 512; // Estimate
-    char* output = (char*)malloc(buffer_size);
-    size_t pos = 0;
+static void call_output_fn(const char* data, size_t size, void* user_data) {
+    swiftamr_output_fn fn = *(swiftamr_output_fn*)user_data;
+    fn(data, size);
+}
 
-    // Header
-    pos += snprintf(output + pos, buffer_size - pos,
-                    "read_name\tgene\tscore\tcoverage\tidentity\n");
+// WASM-exported function: Align FASTQ reads, streaming TSV chunks of at most
+// OUTPUT_CHUNK_SIZE bytes to callback. Output memory is constant.
+// Returns the number of rows written, or -1 on error.
+EMSCRIPTEN_KEEPALIVE
+int swiftamr_align_fastq_stream(const char* fastq_data, size_t fastq_size, swiftamr_output_fn callback) {
+    IndexInstance* inst = instance_get(default_handle);
+    if (!inst) {
+        printf("ERROR: Index not initialized\n");
+        return -1;
+    }
 
-    // Results
-    for (uint32_t i = 0; i < num_results; i++) {
-        ReadAlignment* aln = results[i];
+    AlignOutput* out = (AlignOutput*)malloc(sizeof(AlignOutput));
+    if (!out) return -1;
+    tsv_writer_init(&out->writer, call_output_fn, &callback);
 
-        const char* gene_name = "No_hit";
-        if (aln->best_hit.gene_id != UINT32_MAX) {
-            gene_name = global_index->genes[aln->best_hit.gene_id].name;
+    FastqInput in = {fastq_data, fastq_size, NULL, 0, 0};
+    int ret = align_to_writer(inst, &in, out);
+    free(out);
+    return ret;
+}
+
+// WASM-exported function: Release the buffer filled by swiftamr_index_align
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_index_output_release(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    if (!inst) return;
+    free(inst->output_data);
+    inst->output_data = NULL;
+    inst->output_size = 0;
+}
+
+// WASM-exported function: Pointer to the last aligned output of a handle (not NUL-terminated)
+EMSCRIPTEN_KEEPALIVE
+uint8_t* swiftamr_index_output_data(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    return inst ? inst->output_data : NULL;
+}
+
+// WASM-exported function: Size in bytes of the last aligned output of a handle
+EMSCRIPTEN_KEEPALIVE
+size_t swiftamr_index_output_size(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    return inst ? inst->output_size : 0;
+}
+
+// WASM-exported functions: the same for the default index
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_output_release() {
+    swiftamr_index_output_release(default_handle);
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint8_t* swiftamr_output_data() {
+    return swiftamr_index_output_data(default_handle);
+}
+
+EMSCRIPTEN_KEEPALIVE
+size_t swiftamr_output_size() {
+    return swiftamr_index_output_size(default_handle);
+}
+
+// Align input into the instance's output buffer in the given OutputFormat.
+// Returns rows or -1.
+static int align_to_buffer(IndexInstance* inst, const FastqInput* in, int format) {
+    if (!inst) {
+        printf("ERROR: Index not initialized\n");
+        return -1;
+    }
+    free(inst->output_data);
+    inst->output_data = NULL;
+    inst->output_size = 0;
+
+    if (format == OUTPUT_FORMAT_BINARY) {
+        ResultBuffer rows_buffer;
+        ResultBuffer* results = &rows_buffer;
+        ResultCollector collector = {results, 0};
+        AlignStats align_stats = {0};
+        if (result_buffer_init(results, RESULT_BATCH_ROWS) < 0) return -1;
+        results->source = in->r1;
+        if (align_input_stream(inst, in, result_buffer_collect, &collector, &align_stats) < 0 || collector.failed) {
+            result_buffer_free(results);
+            printf("ERROR: Alignment failed\n");
+            return -1;
+        }
+        trace_begin("output_flush", "rows", results->count);
+        inst->output_data = results_to_binary(results, inst->index, &inst->output_size);
+        trace_end("output_flush", NULL, 0);
+        uint32_t rows = results->count;
+        result_buffer_free(results);
+        if (!inst->output_data) {
+            printf("ERROR: Alignment failed\n");
+            return -1;
         }
+        report_alignment(inst, rows, &align_stats);
+        return (int)rows;
+    }
 
-        pos += snprintf(output + pos, buffer_size - pos,
-                       "%s\t%s\t%u\t%.4f\t%.4f\n",
-                       aln->read_name,
-                       gene_name,
-                       aln->best_hit.score,
-                       aln->best_hit.coverage,
-                       aln->best_hit.identity);
+    StringSink sink = {(char*)malloc(OUTPUT_CHUNK_SIZE), 0, OUTPUT_CHUNK_SIZE};
+    AlignOutput* out = (AlignOutput*)malloc(sizeof(AlignOutput));
+    if (!sink.data || !out) {
+        free(sink.data);
+        free(out);
+        return -1;
+    }
+    tsv_writer_init(&out->writer, append_to_string, &sink);
+
+    int ret = format == OUTPUT_FORMAT_GENE_SUMMARY ? summarize_to_writer(inst, in, &out->writer)
+              : format == OUTPUT_FORMAT_PREVIEW ? preview_to_writer(inst, in, &out->writer)
+              : align_to_writer(inst, in, out);
+    free(out);
 
-        alignment_destroy(aln);
+    if (ret < 0 || !sink.data) {
+        free(sink.data);
+        return -1;
     }
+    inst->output_data = (uint8_t*)sink.data;
+    inst->output_size = sink.size;
+    return ret;
+}
 
-    if (results) free(results);
+// WASM-exported function: Align FASTQ data against one index handle into its
+// output buffer (swiftamr_index_output_data/size/release). r2 is the R2 file
+// when paired; with paired set and r2 NULL, mates alternate in r1.
+// format is an OutputFormat. Returns rows (reads or pairs), or -1 on error.
+EMSCRIPTEN_KEEPALIVE
+int swiftamr_index_align(int handle, const char* r1_data, size_t r1_size,
+                         const char* r2_data, size_t r2_size, int paired, int format) {
+    FastqInput in = {r1_data, r1_size, r2_data, r2_size, paired || r2_data != NULL};
+    return align_to_buffer(instance_get(handle), &in, format);
+}
 
-    return output;
+// WASM-exported function: Align FASTQ reads into an engine-owned buffer as
+// TSV (format 0), the binary layout of results_to_binary (format 1), the
+// per-gene summary table (format 2, no per-read rows) or the preview table
+// (format 3, see swiftamr_set_preview_options).
+// JS copies swiftamr_output_size() bytes at swiftamr_output_data() straight
+// out of HEAPU8, then calls swiftamr_output_release().
+// Returns the number of rows, or -1 on error.
+EMSCRIPTEN_KEEPALIVE
+int swiftamr_align_fastq_to_buffer(const char* fastq_data, size_t fastq_size, int format) {
+    FastqInput in = {fastq_data, fastq_size, NULL, 0, 0};
+    return align_to_buffer(instance_get(default_handle), &in, format);
 }
 
-// WASM-exported function: Get index stats
+// WASM-exported function: Paired-end version of swiftamr_align_fastq_to_buffer.
+// Mates are read from r1/r2 in lockstep, or alternate in r1 when r2 is NULL
+// (interleaved). Evidence from both mates decides a single hit per pair.
+// Returns the number of pairs, or -1 on error (including unequal mate counts).
 EMSCRIPTEN_KEEPALIVE
-char* swiftamr_get_stats() {
-    if (!global_index) {
+int swiftamr_align_pairs_to_buffer(const char* r1_data, size_t r1_size,
+                                   const char* r2_data, size_t r2_size, int format) {
+    FastqInput in = {r1_data, r1_size, r2_data, r2_size, 1};
+    return align_to_buffer(instance_get(default_handle), &in, format);
+}
+
+// WASM-exported function: Get stats of an index handle
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_index_stats(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    if (!inst) {
         return strdup("No index loaded");
     }
 
-    char* stats = (char*)malloc(1024);
-    snprintf(stats, 1024,
+    const KmerIndex* index = inst->index;
+    const IndexStats* st = &index->stats;
+    const AlignStats* as = &inst->last_align_stats;
+    char* stats = (char*)malloc(2048);
+    snprintf(stats, 2048,
              "Index Statistics:\n"
              "  Number of genes: %u\n"
              "  K-mer size: %d\n"
-             "  Hash table size: %u\n",
-             global_index->num_genes,
+             "  Hash table size: %u (load factor %.2f)\n"
+             "  Reference k-mer stride: %u\n"
+             "  Distinct k-mers: %u\n"
+             "  Longest hit list: %u\n"
+             "  High-frequency k-mers %s: %u (%llu hits removed, limit %u)\n"
+             "  Low-complexity masked bases: %llu\n"
+             "  Low-complexity masked k-mers: %llu\n"
+             "  Packed sequence arena: %llu bases, %llu bytes (%u N runs)\n"
+             "  Gene name pool: %u bytes\n"
+             "  K-mer entry arena: %llu bytes\n"
+             "  Hit lists: %llu bytes\n"
+             "Last Alignment:\n"
+             "  Reads skipped (low quality): %llu\n"
+             "  K-mers skipped (low quality): %llu\n"
+             "  Read cache hits: %llu / %llu (%.1f%%)\n"
+             "  K-mers credited by seed extension: %llu\n"
+             "  Reads with a tied best score: %llu\n"
+             "  Reads without a hit: %llu / %llu\n"
+             "  K-mer lookups: %llu (%.1f%% found, %.2f chain probes per lookup)\n",
+             index->num_genes,
              KMER_SIZE,
-             global_index->table_size);
+             index->table_size,
+             (double)st->distinct_kmers / index->table_size,
+             index->options.kmer_stride,
+             st->distinct_kmers,
+             st->max_hits_seen,
+             index->options.cap_mode == KMER_CAP_TRUNCATE ? "truncated" : "dropped",
+             st->capped_kmers,
+             (unsigned long long)st->capped_hits,
+             index->options.max_kmer_hits,
+             (unsigned long long)st->masked_bases,
+             (unsigned long long)st->masked_kmers,
+             (unsigned long long)index->seq_arena_bases,
+             (unsigned long long)(PACKED_WORDS(index->seq_arena_bases) * sizeof(uint64_t)),
+             index->num_n_runs,
+             index->name_pool_size,
+             (unsigned long long)index->entry_arena.bytes_allocated,
+             (unsigned long long)(index->hit_pool_size * sizeof(KmerHit) +
+                                  index->hit_arena.bytes_allocated),
+             (unsigned long long)as->reads_low_quality,
+             (unsigned long long)as->kmers_low_quality,
+             (unsigned long long)as->cache_hits,
+             (unsigned long long)as->cache_lookups,
+             as->cache_lookups ? 100.0 * as->cache_hits / as->cache_lookups : 0.0,
+             (unsigned long long)as->kmers_extended,
+             (unsigned long long)as->reads_tied,
+             (unsigned long long)as->reads_no_hit,
+             (unsigned long long)as->reads_aligned,
+             (unsigned long long)as->lookups,
+             as->lookups ? 100.0 * as->lookup_hits / as->lookups : 0.0,
+             as->lookups ? (double)as->chain_probes / as->lookups : 0.0);
 
     return stats;
 }
 
-// WASM-exported function: Free resources
+// WASM-exported function: Get stats of the default index
 EMSCRIPTEN_KEEPALIVE
-void swiftamr_cleanup() {
-    if (global_index) {
-        index_destroy(global_index);
-        global_index = NULL;
+char* swiftamr_get_stats() {
+    return swiftamr_index_stats(default_handle);
+}
+
+// WASM-exported function: Hot-path counters of the handle's last alignment
+// as a JSON object. The caller frees the string.
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_index_counters(int handle) {
+    IndexInstance* inst = instance_get(handle);
+    if (!inst) return strdup("{}");
+
+    const AlignStats* as = &inst->last_align_stats;
+    char* json = (char*)malloc(2048);
+    if (!json) return NULL;
+    snprintf(json, 2048,
+             "{\"reads\":{\"aligned\":%llu,\"no_hit\":%llu,\"tied\":%llu,\"low_quality\":%llu},"
+             "\"kmers\":{\"extracted\":%llu,\"extended\":%llu,\"low_quality\":%llu},"
+             "\"lookups\":{\"total\":%llu,\"hits\":%llu,\"hit_rate\":%.4f,"
+             "\"hit_entries_visited\":%llu,\"chain_probes\":%llu,\"mean_chain_probes\":%.3f},"
+             "\"read_cache\":{\"lookups\":%llu,\"hits\":%llu},"
+             "\"time_ms\":{\"parse\":%.3f,\"lookup\":%.3f,\"score\":%.3f,\"output\":%.3f,\"total\":%.3f},"
+             "\"timing_sample_interval\":%d}",
+             (unsigned long long)as->reads_aligned,
+             (unsigned long long)as->reads_no_hit,
+             (unsigned long long)as->reads_tied,
+             (unsigned long long)as->reads_low_quality,
+             (unsigned long long)as->kmers_extracted,
+             (unsigned long long)as->kmers_extended,
+             (unsigned long long)as->kmers_low_quality,
+             (unsigned long long)as->lookups,
+             (unsigned long long)as->lookup_hits,
+             as->lookups ? (double)as->lookup_hits / as->lookups : 0.0,
+             (unsigned long long)as->hits_visited,
+             (unsigned long long)as->chain_probes,
+             as->lookups ? (double)as->chain_probes / as->lookups : 0.0,
+             (unsigned long long)as->cache_lookups,
+             (unsigned long long)as->cache_hits,
+             as->parse_ns / 1e6, as->lookup_ns / 1e6, as->score_ns / 1e6,
+             as->output_ns / 1e6, as->total_ns / 1e6,
+             ALIGN_TIMING_SAMPLE);
+    return json;
+}
+
+static void sink_printf(StringSink* sink, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) append_to_string(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1, sink);
+}
+
+// JSON string literal: quotes, backslashes and control characters escaped
+static void sink_json_string(StringSink* sink, const char* str) {
+    append_to_string("\"", 1, sink);
+    for (const char* p = str; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = {'\\', (char)c};
+            append_to_string(escaped, 2, sink);
+        } else if (c < 0x20) {
+            sink_printf(sink, "\\u%04x", c);
+        } else {
+            append_to_string(p, 1, sink);
+        }
+    }
+    append_to_string("\"", 1, sink);
+}
+
+static void sink_histogram(StringSink* sink, const uint64_t* bins) {
+    int last = DIAG_HISTOGRAM_BINS - 1;
+    while (last > 0 && bins[last] == 0) last--;
+    sink_printf(sink, "[");
+    for (int b = 0; b <= last; b++) {
+        sink_printf(sink, b ? ",%llu" : "%llu", (unsigned long long)bins[b]);
+    }
+    sink_printf(sink, "]");
+}
+
+// WASM-exported function: Structure of a handle's index as a JSON object:
+// load factor and chain lengths, hit-list lengths, the top_n k-mers with the
+// longest hit lists and their genes, bytes per component and per-gene k-mer
+// counts. The caller frees the string.
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_index_diagnostics(int handle, uint32_t top_n) {
+    IndexInstance* inst = instance_get(handle);
+    if (!inst) return strdup("{}");
+    const KmerIndex* index = inst->index;
+
+    IndexDiagnostics diag;
+    if (index_diagnostics(index, top_n, &diag) < 0) {
+        index_diagnostics_free(&diag);
+        return NULL;
+    }
+
+    StringSink sink = {(char*)malloc(OUTPUT_CHUNK_SIZE), 0, OUTPUT_CHUNK_SIZE};
+    if (!sink.data) {
+        index_diagnostics_free(&diag);
+        return NULL;
+    }
+    sink.data[0] = '\0';
+
+    sink_printf(&sink, "{\"kmer_size\":%d,\"genes\":%u,\"kmer_stride\":%u,", KMER_SIZE, index->num_genes,
+                index->options.kmer_stride);
+    sink_printf(&sink, "\"table\":{\"buckets\":%u,\"used_buckets\":%llu,\"distinct_kmers\":%llu,"
+                "\"load_factor\":%.4f,\"longest_chain\":%u,\"mean_probes_found\":%.4f,"
+                "\"mean_probes_missing\":%.4f,\"chain_histogram\":",
+                diag.table_size, (unsigned long long)diag.used_buckets, (unsigned long long)diag.distinct_kmers,
+                diag.load_factor, diag.longest_chain, diag.mean_probes_found, diag.load_factor);
+    sink_histogram(&sink, diag.chain_histogram);
+    sink_printf(&sink, "},\"hit_lists\":{\"total_hits\":%llu,\"mean_length\":%.4f,\"longest\":%u,"
+                "\"single_gene_kmers\":%llu,\"log2_histogram\":",
+                (unsigned long long)diag.total_hits,
+                diag.distinct_kmers ? (double)diag.total_hits / diag.distinct_kmers : 0.0,
+                diag.longest_hit_list,
+                (unsigned long long)diag.single_gene_kmers);
+    sink_histogram(&sink, diag.hits_histogram);
+
+    sink_printf(&sink, "},\"top_kmers\":[");
+    for (uint32_t i = 0; i < diag.num_top; i++) {
+        const KmerEntry* entry = diag.top[i].entry;
+        char kmer[KMER_SIZE + 1];
+        for (int k = 0; k < KMER_SIZE; k++) {
+            kmer[k] = "ACGT"[(entry->kmer >> (2 * (KMER_SIZE - 1 - k))) & 3];
+        }
+        kmer[KMER_SIZE] = '\0';
+        sink_printf(&sink, "%s{\"kmer\":\"%s\",\"hits\":%u,\"num_genes\":%u,\"genes\":[",
+                    i ? "," : "", kmer, entry->num_hits, diag.top[i].num_genes);
+        uint32_t last_gene = UINT32_MAX, listed = 0;
+        for (uint32_t h = 0; h < entry->num_hits && listed < DIAG_TOP_KMER_GENES; h++) {
+            uint32_t gene_id = entry->hits[h].gene_id;
+            if (gene_id == last_gene || gene_id >= index->num_genes) continue;
+            if (listed++) sink_printf(&sink, ",");
+            sink_json_string(&sink, index_gene_name(index, gene_id));
+            last_gene = gene_id;
+        }
+        sink_printf(&sink, "]}");
     }
+
+    sink_printf(&sink, "],\"bytes\":{\"table\":%llu,\"entries\":%llu,\"hit_lists\":%llu,\"sequences\":%llu,"
+                "\"n_runs\":%llu,\"genes\":%llu,\"names\":%llu,\"total\":%llu},",
+                (unsigned long long)diag.table_bytes, (unsigned long long)diag.entry_bytes,
+                (unsigned long long)diag.hit_bytes, (unsigned long long)diag.sequence_bytes,
+                (unsigned long long)diag.n_run_bytes, (unsigned long long)diag.gene_bytes,
+                (unsigned long long)diag.name_bytes,
+                (unsigned long long)(diag.table_bytes + diag.entry_bytes + diag.hit_bytes + diag.sequence_bytes +
+                                     diag.n_run_bytes + diag.gene_bytes + diag.name_bytes));
+
+    sink_printf(&sink, "\"gene_kmers\":[");
+    for (uint32_t g = 0; g < index->num_genes; g++) {
+        sink_printf(&sink, g ? ",{\"name\":" : "{\"name\":");
+        sink_json_string(&sink, index_gene_name(index, g));
+        sink_printf(&sink, ",\"length\":%u,\"kmers\":%u,\"unique_kmers\":%u}", index->genes[g].length,
+                    diag.gene_kmers[g], diag.gene_unique_kmers[g]);
+    }
+    sink_printf(&sink, "]}");
+
+    index_diagnostics_free(&diag);
+    return sink.data;
+}
+
+// WASM-exported function: Hot-path counters of the default index's last alignment
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_get_counters() {
+    return swiftamr_index_counters(default_handle);
+}
+
+// WASM-exported function: Start recording trace spans (index build, FASTA
+// parse, FASTQ chunks, alignment batches, output), discarding any earlier trace
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_trace_start() {
+    trace_start();
+}
+
+// WASM-exported function: Stop recording and return the trace as Chrome
+// trace-event JSON (load it in Perfetto or chrome://tracing). The caller
+// frees the string.
+EMSCRIPTEN_KEEPALIVE
+char* swiftamr_trace_stop() {
+    trace_stop();
+    char* json = trace_json(NULL);
+    trace_clear();
+    return json;
+}
+
+// WASM-exported function: Content hash of the default index ("" if none)
+EMSCRIPTEN_KEEPALIVE
+const char* swiftamr_get_hash() {
+    return swiftamr_index_hash(default_handle);
+}
+
+// WASM-exported function: Free the default index (other handles stay loaded)
+EMSCRIPTEN_KEEPALIVE
+void swiftamr_cleanup() {
+    swiftamr_index_destroy(default_handle);
 }
 
 // For testing in native environment
 #ifndef __EMSCRIPTEN__
+static void write_stdout(const char* data, size_t size) {
+    fwrite(data, 1, size, stdout);
+}
+
+// Read a whole file into a NUL-terminated buffer; NULL if it cannot be opened
+static char* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = (char*)malloc(*size + 1);
+    if (data) {
+        *size = fread(data, 1, *size, file);
+        data[*size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
+
+// --progress: one line on stderr per progress callback
+static void print_progress(const AlignProgress* progress, void* user_data) {
+    (void)user_data;
+    double fraction = progress->total_bytes ? (double)progress->bytes / progress->total_bytes : 1.0;
+    fprintf(stderr, "Progress: %llu reads, %.1f / %.1f MB (%.1f%%), %.0f reads/s",
+            (unsigned long long)progress->reads, progress->bytes / 1048576.0,
+            progress->total_bytes / 1048576.0, 100.0 * fraction, progress->reads_per_sec);
+    if (progress->done) {
+        fprintf(stderr, ", done in %.1fs\n", progress->seconds);
+    } else if (fraction > 0) {
+        fprintf(stderr, ", ETA %.0fs\n", progress->seconds * (1.0 - fraction) / fraction);
+    } else {
+        fprintf(stderr, "\n");
+    }
+}
+
+// Ctrl-C during alignment cancels it: the rows so far are still written and
+// a second Ctrl-C exits immediately
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int sig) {
+    interrupted = 1;
+    signal(sig, SIG_DFL);
+}
+
+static int interrupt_requested(void* user_data) {
+    (void)user_data;
+    return interrupted;
+}
+
+// One line of the --perf-counters report: each event's total and its count
+// per read and per k-mer (where those are non-zero)
+static void print_perf_phase(const char* phase, const uint64_t values[PERF_NUM_EVENTS],
+                             uint64_t reads, uint64_t kmers) {
+    printf("  %s:\n", phase);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (values[e] == UINT64_MAX) {
+            printf("    %-14s n/a\n", PERF_EVENT_NAMES[e]);
+            continue;
+        }
+        printf("    %-14s %15llu", PERF_EVENT_NAMES[e], (unsigned long long)values[e]);
+        if (reads) printf("  %12.2f per read", (double)values[e] / reads);
+        if (kmers) printf("  %10.3f per k-mer", (double)values[e] / kmers);
+        printf("\n");
+    }
+    if (values[0] != UINT64_MAX && values[1] != UINT64_MAX && values[0]) {
+        printf("    %-14s %15.3f\n", "ipc", (double)values[1] / values[0]);
+    }
+}
+
+// Stop tracing and write the trace JSON to path. Returns 0 or -1.
+static int write_trace(const char* path) {
+    char* json = swiftamr_trace_stop();
+    FILE* file = json ? fopen(path, "w") : NULL;
+    int ok = file && fputs(json, file) >= 0;
+    if (file && fclose(file) != 0) ok = 0;
+    free(json);
+    if (!ok) printf("ERROR: Cannot write trace to %s\n", path);
+    return ok ? 0 : -1;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] <database.fasta> <reads.fastq> [reads_R2.fastq]\n", prog);
+    printf("       %s inspect [index options] [--top N] <database.fasta>\n", prog);
+    printf("A second FASTQ file is aligned with the first as R1/R2 pairs.\n");
+    printf("inspect prints the index structure as JSON: load factor, chain and hit-list\n");
+    printf("histograms, the N k-mers with the longest hit lists (default: %d), bytes per\n", DIAG_TOP_KMERS);
+    printf("component and per-gene unique k-mers.\n");
+    printf("Index options:\n");
+    printf("  --max-kmer-hits N   Limit k-mer hit lists to N entries (default: unlimited)\n");
+    printf("  --cap-mode MODE     drop or truncate k-mers above the limit (default: drop)\n");
+    printf("  --dust[=T]          Mask low-complexity windows scoring above T (default: %.0f)\n", DUST_THRESHOLD);
+    printf("  --dust-window W     Low-complexity window size (default: %d)\n", DUST_WINDOW);
+    printf("  --kmer-stride N     Index every N-th reference k-mer (default: 1)\n");
+    printf("  --max-memory MB     Index memory budget; raises the stride until it fits (default: unlimited)\n");
+    printf("  --index-cache[=DIR] Cache built indexes in DIR (default: off; DIR defaults to\n");
+    printf("                      $XDG_CACHE_HOME/swiftamr or ~/.cache/swiftamr)\n");
+    printf("  --no-index-cache    Always build the index from the FASTA (default)\n");
+    printf("Alignment options:\n");
+    printf("  --min-base-qual Q   Skip k-mers overlapping bases below Phred Q (default: off)\n");
+    printf("  --min-mean-qual Q   Skip reads with mean Phred below Q (default: off)\n");
+    printf("  --read-cache N      Reuse results for exact duplicate reads, N cache slots (default: off)\n");
+    printf("  --no-extend         Look up every k-mer instead of extending seed hits\n");
+    printf("  --progress[=N]      Report progress on stderr every N reads (default: %d) or %d MB\n",
+           PROGRESS_INTERVAL_READS, PROGRESS_INTERVAL_BYTES >> 20);
+    printf("  --interleaved       Reads alternate R1/R2 in one FASTQ; align them as pairs\n");
+    printf("Output options:\n");
+    printf("  --summary           Write per-gene read counts, breadth, depth and RPKM instead of per-read rows\n");
+    printf("  --preview           Align random %d MB chunks until per-gene abundances converge; write\n",
+           PREVIEW_CHUNK_BYTES >> 20);
+    printf("                      each gene's share of reads with a 95%% interval\n");
+    printf("  --preview-seconds S Stop the preview after S seconds (default: no limit)\n");
+    printf("  --preview-reads N   Stop the preview after N reads (default: no limit)\n");
+    printf("                      Budgets are checked between chunks, so a preview can overshoot by one chunk\n");
+    printf("  --preview-tolerance F  Converged when every interval is within F of its estimate (default: %.2f)\n",
+           PREVIEW_REL_TOLERANCE);
+    printf("  --preview-seed N    Chunk order (default: 1)\n");
+    printf("  --stats             Print index statistics\n");
+    printf("  --counters          Print hot-path counters and phase times as JSON\n");
+    printf("  --trace FILE        Write Chrome trace-event JSON of the run to FILE (open in Perfetto)\n");
+    printf("  --perf-counters     Count cycles, instructions, LLC/dTLB/branch misses of index build and alignment (Linux)\n");
+}
+
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        printf("Usage: %s <database.fasta> <reads.fastq>\n", argv[0]);
+    const char* positional[3];
+    int num_positional = 0;
+    int inspect = argc > 1 && strcmp(argv[1], "inspect") == 0;
+    uint32_t top_kmers = DIAG_TOP_KMERS;
+    int show_stats = 0;
+    int show_counters = 0;
+    int summary = 0;
+    int preview = 0;
+    int interleaved = 0;
+    const char* cache_dir = NULL;
+    int use_cache = 0;
+    const char* trace_path = NULL;
+    int perf_mode = 0;
+
+    for (int i = 1 + inspect; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--max-kmer-hits") == 0 && i + 1 < argc) {
+            global_index_options.max_kmer_hits = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--cap-mode") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "drop") == 0) {
+                global_index_options.cap_mode = KMER_CAP_DROP;
+            } else if (strcmp(mode, "truncate") == 0) {
+                global_index_options.cap_mode = KMER_CAP_TRUNCATE;
+            } else {
+                printf("ERROR: Unknown cap mode: %s\n", mode);
+                return 1;
+            }
+        } else if (strcmp(arg, "--dust") == 0 || strncmp(arg, "--dust=", 7) == 0) {
+            // The threshold is attached, so a following path is never taken for it
+            if (global_index_options.dust_window == 0) global_index_options.dust_window = DUST_WINDOW;
+            if (arg[6] == '=') global_index_options.dust_threshold = strtof(arg + 7, NULL);
+        } else if (strcmp(arg, "--dust-window") == 0 && i + 1 < argc) {
+            global_index_options.dust_window = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--kmer-stride") == 0 && i + 1 < argc) {
+            global_index_options.kmer_stride = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--max-memory") == 0 && i + 1 < argc) {
+            global_index_options.max_memory = (uint64_t)strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (strcmp(arg, "--index-cache") == 0 || strncmp(arg, "--index-cache=", 14) == 0) {
+            use_cache = 1;
+            cache_dir = arg[13] == '=' ? arg + 14 : NULL;
+        } else if (strcmp(arg, "--no-index-cache") == 0) {
+            use_cache = 0;
+        } else if (strcmp(arg, "--min-base-qual") == 0 && i + 1 < argc) {
+            global_align_options.min_base_quality = (uint8_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--min-mean-qual") == 0 && i + 1 < argc) {
+            global_align_options.min_mean_quality = (uint8_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--read-cache") == 0 && i + 1 < argc) {
+            global_align_options.read_cache_entries = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--no-extend") == 0) {
+            global_align_options.seed_extend = 0;
+        } else if (strcmp(arg, "--progress") == 0 || strncmp(arg, "--progress=", 11) == 0) {
+            // The interval is attached, so a following path is never taken for it
+            global_align_options.progress = print_progress;
+            if (arg[10] == '=' && strtoul(arg + 11, NULL, 10) > 0) {
+                global_align_options.progress_reads = (uint32_t)strtoul(arg + 11, NULL, 10);
+            }
+        } else if (strcmp(arg, "--interleaved") == 0) {
+            interleaved = 1;
+        } else if (strcmp(arg, "--summary") == 0) {
+            summary = 1;
+        } else if (strcmp(arg, "--preview") == 0) {
+            preview = 1;
+        } else if (strcmp(arg, "--preview-seconds") == 0 && i + 1 < argc) {
+            preview = 1;
+            global_preview_options.max_seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(arg, "--preview-reads") == 0 && i + 1 < argc) {
+            preview = 1;
+            global_preview_options.max_reads = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--preview-tolerance") == 0 && i + 1 < argc) {
+            preview = 1;
+            global_preview_options.rel_tolerance = strtof(argv[++i], NULL);
+        } else if (strcmp(arg, "--preview-seed") == 0 && i + 1 < argc) {
+            preview = 1;
+            global_preview_options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(arg, "--counters") == 0) {
+            show_counters = 1;
+        } else if (strcmp(arg, "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(arg, "--perf-counters") == 0) {
+            perf_mode = 1;
+        } else if (strcmp(arg, "--top") == 0 && inspect && i + 1 < argc) {
+            top_kmers = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        } else if (num_positional < 3) {
+            positional[num_positional++] = arg;
+        }
+    }
+
+    if (num_positional < (inspect ? 1 : 2)) {
+        print_usage(argv[0]);
         return 1;
     }
 
+    if (trace_path) swiftamr_trace_start();
+
     // Load FASTA
-    FILE* fasta_file = fopen(argv[1], "r");
-    if (!fasta_file) {
+    size_t fasta_size;
+    char* fasta_data = read_file(positional[0], &fasta_size);
+    if (!fasta_data) {
         printf("ERROR: Cannot open FASTA file\n");
         return 1;
     }
 
-    fseek(fasta_file, 0, SEEK_END);
-    size_t fasta_size = ftell(fasta_file);
-    fseek(fasta_file, 0, SEEK_SET);
+    // Build index, or load it from the cache directory
+    char default_cache_dir[4096];
+    if (use_cache && !cache_dir) {
+        const char* xdg = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        if (xdg && xdg[0]) {
+            snprintf(default_cache_dir, sizeof(default_cache_dir), "%s/swiftamr", xdg);
+            cache_dir = default_cache_dir;
+        } else if (home && home[0]) {
+            snprintf(default_cache_dir, sizeof(default_cache_dir), "%s/.cache/swiftamr", home);
+            cache_dir = default_cache_dir;
+        }
+    }
+    if (use_cache && cache_dir) index_storage_directory(&index_storage, cache_dir);
 
-    char* fasta_data = (char*)malloc(fasta_size + 1);
-    fread(fasta_data, 1, fasta_size, fasta_file);
-    fasta_data[fasta_size] = '\0';
-    fclose(fasta_file);
+    // Hardware counters are read around the index build and the alignment
+    PerfCounters perf;
+    uint64_t build_counts[PERF_NUM_EVENTS], align_counts[PERF_NUM_EVENTS];
+    if (perf_mode && perf_counters_open(&perf) == 0) {
+        printf("WARNING: perf_event_open failed; hardware counters unavailable "
+               "(check /proc/sys/kernel/perf_event_paranoid)\n");
+        perf_mode = 0;
+    }
 
-    // Build index
+    if (perf_mode) perf_counters_start(&perf);
     int ret = swiftamr_build_index(fasta_data, fasta_size);
+    if (perf_mode) perf_counters_stop(&perf, build_counts);
     free(fasta_data);
 
     if (ret < 0) return 1;
 
-    // Load FASTQ
-    FILE* fastq_file = fopen(argv[2], "r");
-    if (!fastq_file) {
+    if (inspect) {
+        if (trace_path && write_trace(trace_path) < 0) {
+            swiftamr_cleanup();
+            return 1;
+        }
+        char* report = swiftamr_index_diagnostics(default_handle, top_kmers);
+        if (!report) {
+            printf("ERROR: Out of memory\n");
+            swiftamr_cleanup();
+            return 1;
+        }
+        printf("%s\n", report);
+        free(report);
+        swiftamr_cleanup();
+        return 0;
+    }
+
+    // Load FASTQ (and R2)
+    FastqInput in = {NULL, 0, NULL, 0, interleaved || num_positional == 3};
+    char* fastq_data = read_file(positional[1], &in.r1_size);
+    char* fastq_data2 = num_positional == 3 ? read_file(positional[2], &in.r2_size) : NULL;
+    if (!fastq_data || (num_positional == 3 && !fastq_data2)) {
         printf("ERROR: Cannot open FASTQ file\n");
         return 1;
     }
+    in.r1 = fastq_data;
+    in.r2 = fastq_data2;
 
-    fseek(fastq_file, 0, SEEK_END);
-    size_t fastq_size = ftell(fastq_file);
-    fseek(fastq_file, 0, SEEK_SET);
+    // Align, streaming TSV rows (or the gene table) straight to stdout
+    swiftamr_output_fn output_fn = write_stdout;
+    AlignOutput* out = (AlignOutput*)malloc(sizeof(AlignOutput));
+    if (!out) return 1;
+    tsv_writer_init(&out->writer, call_output_fn, &output_fn);
+    IndexInstance* inst = instance_get(default_handle);
+    global_align_options.cancel = interrupt_requested;
+    signal(SIGINT, on_interrupt);
+    if (perf_mode) perf_counters_start(&perf);
+    int aligned = preview ? preview_to_writer(inst, &in, &out->writer)
+                  : summary ? summarize_to_writer(inst, &in, &out->writer)
+                  : align_to_writer(inst, &in, out);
+    if (perf_mode) perf_counters_stop(&perf, align_counts);
+    signal(SIGINT, SIG_DFL);
+    free(out);
+    free(fastq_data);
+    free(fastq_data2);
+    if (trace_path && write_trace(trace_path) < 0) aligned = -1;
 
-    char* fastq_data = (char*)malloc(fastq_size + 1);
-    fread(fastq_data, 1, fastq_size, fastq_file);
-    fastq_data[fastq_size] = '\0';
-    fclose(fastq_file);
+    if (show_stats) {
+        char* stats = swiftamr_get_stats();
+        printf("%s", stats);
+        free(stats);
+    }
 
-    // Align
-    char* results = swiftamr_align_fastq(fastq_data, fastq_size);
-    free(fastq_data);
+    if (show_counters) {
+        char* counters = swiftamr_get_counters();
+        printf("%s\n", counters);
+        free(counters);
+    }
 
-    printf("\n%s\n", results);
-    free(results);
+    if (perf_mode) {
+        // Build k-mers are the reference positions indexed (before capping)
+        const KmerIndex* index = inst->index;
+        const AlignStats* as = &inst->last_align_stats;
+        printf("Hardware Counters (user space):\n");
+        print_perf_phase("index build", build_counts, 0, index->hit_pool_size + index->stats.capped_hits);
+        print_perf_phase("alignment", align_counts, as->reads_aligned + as->reads_low_quality,
+                         as->kmers_extracted);
+        perf_counters_close(&perf);
+    }
 
     swiftamr_cleanup();
 
-    return 0;
+    if (interrupted) return 130;
+    return aligned < 0 ? 1 : 0;
 }
 #endif
@@ -0,0 +1,256 @@
+#include "swiftamr.h"
+
+// Decimal digits of value, written at out; returns the end pointer
+char* format_uint(char* out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value);
+    while (n) *out++ = digits[--n];
+    return out;
+}
+
+// Fixed-point with four decimals (same as "%.4f" for finite values)
+char* format_fixed4(char* out, float value) {
+    if (value != value) value = 0.0f; // NaN
+    if (value < 0) {
+        *out++ = '-';
+        value = -value;
+    }
+    // A float times 10000 is exact in a double, so ties are real ties and
+    // round to even like printf
+    double x = (double)value * 10000.0;
+    uint64_t scaled = (uint64_t)x;
+    double rem = x - (double)scaled;
+    if (rem > 0.5 || (rem == 0.5 && (scaled & 1))) scaled++;
+    out = format_uint(out, scaled / 10000);
+    uint32_t frac = (uint32_t)(scaled % 10000);
+    *out++ = '.';
+    *out++ = '0' + frac / 1000;
+    *out++ = '0' + (frac / 100) % 10;
+    *out++ = '0' + (frac / 10) % 10;
+    *out++ = '0' + frac % 10;
+    return out;
+}
+
+void tsv_writer_init(TsvWriter* writer, OutputCallback callback, void* user_data) {
+    writer->used = 0;
+    writer->bytes_written = 0;
+    writer->callback = callback;
+    writer->user_data = user_data;
+}
+
+void tsv_writer_flush(TsvWriter* writer) {
+    if (writer->used == 0) return;
+    writer->callback(writer->buffer, writer->used, writer->user_data);
+    writer->bytes_written += writer->used;
+    writer->used = 0;
+}
+
+// Append raw bytes, flushing as often as needed
+void tsv_writer_write(TsvWriter* writer, const char* data, size_t size) {
+    while (size > 0) {
+        if (writer->used == OUTPUT_CHUNK_SIZE) tsv_writer_flush(writer);
+        size_t n = OUTPUT_CHUNK_SIZE - writer->used;
+        if (n > size) n = size;
+        memcpy(writer->buffer + writer->used, data, n);
+        writer->used += n;
+        data += n;
+        size -= n;
+    }
+}
+
+void tsv_writer_header(TsvWriter* writer) {
+    static const char header[] = "read_name\tgene\tscore\tcoverage\tidentity\n";
+    tsv_writer_write(writer, header, sizeof(header) - 1);
+}
+
+// Format one batch of results as TSV rows
+void tsv_writer_rows(TsvWriter* writer, const ResultBuffer* batch, const KmerIndex* index) {
+    char fields[64];
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const char* gene_name = "No_hit";
+        uint32_t gene_length = 6;
+        if (batch->gene_id[i] != UINT32_MAX) {
+            gene_name = index_gene_name(index, batch->gene_id[i]);
+            gene_length = index->genes[batch->gene_id[i]].name_length;
+        }
+
+        char* p = fields;
+        *p++ = '\t';
+        p = format_uint(p, batch->score[i]);
+        *p++ = '\t';
+        p = format_fixed4(p, batch->coverage[i]);
+        *p++ = '\t';
+        p = format_fixed4(p, batch->identity[i]);
+        *p++ = '\n';
+
+        size_t row_size = batch->name_length[i] + 1 + gene_length + (p - fields);
+        if (writer->used + row_size <= OUTPUT_CHUNK_SIZE) {
+            // Fast path: the whole row fits in the chunk
+            char* out = writer->buffer + writer->used;
+            memcpy(out, batch->source + batch->name_offset[i], batch->name_length[i]);
+            out += batch->name_length[i];
+            *out++ = '\t';
+            memcpy(out, gene_name, gene_length);
+            out += gene_length;
+            memcpy(out, fields, p - fields);
+            writer->used += row_size;
+        } else {
+            tsv_writer_write(writer, batch->source + batch->name_offset[i], batch->name_length[i]);
+            tsv_writer_write(writer, "\t", 1);
+            tsv_writer_write(writer, gene_name, gene_length);
+            tsv_writer_write(writer, fields, p - fields);
+        }
+    }
+}
+
+// Per-gene table for summary mode: one row per gene with at least one read.
+// breadth is the covered fraction of the gene, mean_depth the aligned bases
+// over gene length, rpkm reads per kilobase per million mapped reads.
+void tsv_writer_gene_summary(TsvWriter* writer, const GeneSummary* summary, const KmerIndex* index) {
+    static const char header[] = "gene\tlength\treads\tbreadth\tmean_depth\tscore_sum\trpkm\n";
+    tsv_writer_write(writer, header, sizeof(header) - 1);
+
+    char fields[160];
+    for (uint32_t g = 0; g < summary->num_genes; g++) {
+        uint64_t reads = summary->read_counts[g];
+        if (reads == 0) continue;
+        uint32_t length = index->genes[g].length;
+
+        char* p = fields;
+        *p++ = '\t';
+        p = format_uint(p, length);
+        *p++ = '\t';
+        p = format_uint(p, reads);
+        *p++ = '\t';
+        p = format_fixed4(p, (float)((double)gene_summary_covered_bases(summary, g) / length));
+        *p++ = '\t';
+        p = format_fixed4(p, (float)((double)summary->aligned_bases[g] / length));
+        *p++ = '\t';
+        p = format_uint(p, summary->score_sums[g]);
+        *p++ = '\t';
+        p = format_fixed4(p, (float)(reads * 1e9 / ((double)length * summary->reads_mapped)));
+        *p++ = '\n';
+
+        tsv_writer_write(writer, index_gene_name(index, g), index->genes[g].name_length);
+        tsv_writer_write(writer, fields, p - fields);
+    }
+}
+
+// Per-gene table for preview mode: one row per gene with at least one
+// sampled read. percent_reads is the gene's share of the sampled reads with
+// its confidence interval; est_reads scales that share to the whole file.
+// A leading "# " comment line records why the preview stopped and how much
+// of the file it read, since the estimates mean little without it.
+void tsv_writer_gene_preview(TsvWriter* writer, const GenePreview* preview, const GeneSummary* summary,
+                             const KmerIndex* index) {
+    static const char header[] = "gene\treads\tpercent_reads\tci_low\tci_high\test_reads\n";
+    char line[160] = "# ";
+    if (preview_describe(preview, line + 2, sizeof(line) - 3) > 0) {
+        size_t used = strlen(line);
+        line[used++] = '\n';
+        tsv_writer_write(writer, line, used);
+    }
+    tsv_writer_write(writer, header, sizeof(header) - 1);
+
+    // Reads in the whole file, extrapolated from the bytes sampled
+    double file_reads = preview->bytes_done
+                        ? (double)preview->reads_done * preview->bytes_total / preview->bytes_done : 0.0;
+    char fields[128];
+    for (uint32_t g = 0; g < preview->num_genes; g++) {
+        uint64_t reads = summary->read_counts[g];
+        if (reads == 0) continue;
+        double p = preview->abundance[g], half = preview->ci_half[g];
+        double low = p - half > 0 ? p - half : 0.0, high = p + half < 1 ? p + half : 1.0;
+
+        char* out = fields;
+        *out++ = '\t';
+        out = format_uint(out, reads);
+        *out++ = '\t';
+        out = format_fixed4(out, (float)(100.0 * p));
+        *out++ = '\t';
+        out = format_fixed4(out, (float)(100.0 * low));
+        *out++ = '\t';
+        out = format_fixed4(out, (float)(100.0 * high));
+        *out++ = '\t';
+        out = format_uint(out, (uint64_t)(p * file_reads + 0.5));
+        *out++ = '\n';
+
+        tsv_writer_write(writer, index_gene_name(index, g), index->genes[g].name_length);
+        tsv_writer_write(writer, fields, out - fields);
+    }
+}
+
+// Compact binary results, laid out so every column can be viewed in place as
+// a typed array (all integers and floats little-endian, sections 4-byte aligned):
+//
+//   char     magic[4] = "SAMR"
+//   uint32_t version, num_records, num_genes, gene_names_size, read_names_size
+//   uint32_t gene_name_offsets[num_genes + 1]   (into gene_names)
+//   uint32_t gene_id[num_records]               (UINT32_MAX = no hit)
+//   uint32_t score[num_records]
+//   float    coverage[num_records]
+//   float    identity[num_records]
+//   uint32_t kmers[num_records]
+//   uint32_t read_name_offsets[num_records + 1] (into read_names)
+//   char     gene_names[gene_names_size]        (padded to 4 bytes)
+//   char     read_names[read_names_size]
+//
+// Names are not NUL-terminated. Returns a malloc'd buffer and its size.
+uint8_t* results_to_binary(const ResultBuffer* results, const KmerIndex* index, size_t* size) {
+    uint32_t n = results->count;
+    uint32_t num_genes = index->num_genes;
+    uint32_t gene_names_size = 0, read_names_size = 0;
+
+    for (uint32_t g = 0; g < num_genes; g++) gene_names_size += index->genes[g].name_length;
+    for (uint32_t i = 0; i < n; i++) read_names_size += results->name_length[i];
+
+    uint32_t padded_gene_names = (gene_names_size + 3) & ~3U;
+    size_t total = 24 + 4 * ((size_t)num_genes + 1) + 4 * ((size_t)n * 6 + 1) +
+                   padded_gene_names + read_names_size;
+    uint8_t* out = (uint8_t*)calloc(total ? total : 1, 1);
+    if (!out) return NULL;
+
+    uint32_t header[5] = {RESULT_BINARY_VERSION, n, num_genes, gene_names_size, read_names_size};
+    memcpy(out, "SAMR", 4);
+    memcpy(out + 4, header, sizeof(header));
+    uint8_t* p = out + 24;
+
+    uint32_t offset = 0;
+    for (uint32_t g = 0; g <= num_genes; g++) {
+        memcpy(p, &offset, 4);
+        p += 4;
+        if (g < num_genes) offset += index->genes[g].name_length;
+    }
+
+    memcpy(p, results->gene_id, n * 4);  p += n * 4;
+    memcpy(p, results->score, n * 4);    p += n * 4;
+    memcpy(p, results->coverage, n * 4); p += n * 4;
+    memcpy(p, results->identity, n * 4); p += n * 4;
+    memcpy(p, results->kmers, n * 4);    p += n * 4;
+
+    offset = 0;
+    for (uint32_t i = 0; i <= n; i++) {
+        memcpy(p, &offset, 4);
+        p += 4;
+        if (i < n) offset += results->name_length[i];
+    }
+
+    for (uint32_t g = 0; g < num_genes; g++) {
+        memcpy(p, index_gene_name(index, g), index->genes[g].name_length);
+        p += index->genes[g].name_length;
+    }
+    p += padded_gene_names - gene_names_size;
+
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(p, results->source + results->name_offset[i], results->name_length[i]);
+        p += results->name_length[i];
+    }
+
+    *size = total;
+    return out;
+}
@@ -0,0 +1,106 @@
+#define _DEFAULT_SOURCE // syscall()
+#include "swiftamr.h"
+
+// Hardware counters through perf_event_open. Each event is opened on its own
+// (not as a group), so one that the CPU or kernel does not offer leaves the
+// others usable; counts are scaled when the kernel had to multiplex them.
+
+const char* const PERF_EVENT_NAMES[PERF_NUM_EVENTS] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int perf_event_open_fd(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// Open the counters for the calling thread. Returns the number of events
+// available (0 when perf_event_open is not permitted, see
+// /proc/sys/kernel/perf_event_paranoid).
+int perf_counters_open(PerfCounters* perf) {
+    static const uint32_t types[PERF_NUM_EVENTS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+    };
+    static const uint64_t configs[PERF_NUM_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL), CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB),
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    int available = 0;
+    memset(perf, 0, sizeof(*perf));
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        perf->fds[e] = perf_event_open_fd(types[e], configs[e]);
+        if (perf->fds[e] >= 0) available++;
+    }
+    return available;
+}
+
+void perf_counters_start(PerfCounters* perf) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (perf->fds[e] < 0) continue;
+        ioctl(perf->fds[e], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// Stop counting and store the counts since perf_counters_start in values
+// (UINT64_MAX for events that are not available)
+void perf_counters_stop(PerfCounters* perf, uint64_t values[PERF_NUM_EVENTS]) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        values[e] = UINT64_MAX;
+        if (perf->fds[e] < 0) continue;
+        ioctl(perf->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (read(perf->fds[e], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) continue;
+        values[e] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    }
+}
+
+void perf_counters_close(PerfCounters* perf) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (perf->fds[e] >= 0) close(perf->fds[e]);
+        perf->fds[e] = -1;
+    }
+}
+
+#else
+
+int perf_counters_open(PerfCounters* perf) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) perf->fds[e] = -1;
+    return 0;
+}
+
+void perf_counters_start(PerfCounters* perf) {
+    (void)perf;
+}
+
+void perf_counters_stop(PerfCounters* perf, uint64_t values[PERF_NUM_EVENTS]) {
+    (void)perf;
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) values[e] = UINT64_MAX;
+}
+
+void perf_counters_close(PerfCounters* perf) {
+    (void)perf;
+}
+
+#endif
@@ -0,0 +1,220 @@
+#include "swiftamr.h"
+#include <math.h>
+
+// Preview mode: align the FASTQ in chunks taken in random order and stop as
+// soon as the per-gene abundances are known well enough. Chunks are clusters
+// of a simple random sample, so each gene's share of reads is a ratio
+// estimate whose variance comes from how much that share differs between the
+// chunks aligned so far (with the finite population correction: once every
+// chunk is aligned the interval is exact).
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static size_t next_line(const char* data, size_t size, size_t pos) {
+    while (pos < size && data[pos] != '\n') pos++;
+    return pos < size ? pos + 1 : size;
+}
+
+// Start of the first FASTQ record at or after pos. Quality lines may begin
+// with '@' too, so a header is only accepted when the line after its
+// sequence starts with '+'.
+static size_t record_start_at(const char* data, size_t size, size_t pos) {
+    if (pos == 0) return 0;
+    if (pos >= size) return size;
+    if (data[pos - 1] != '\n') pos = next_line(data, size, pos);
+    while (pos < size) {
+        if (data[pos] == '@') {
+            size_t plus = next_line(data, size, next_line(data, size, pos));
+            if (plus < size && data[plus] == '+') return pos;
+        }
+        pos = next_line(data, size, pos);
+    }
+    return size;
+}
+
+void preview_options_default(PreviewOptions* opts) {
+    opts->max_seconds = 0;
+    opts->max_reads = 0;
+    opts->rel_tolerance = PREVIEW_REL_TOLERANCE;
+    opts->abs_tolerance = PREVIEW_ABS_TOLERANCE;
+    opts->min_chunks = PREVIEW_MIN_CHUNKS;
+    opts->chunk_bytes = PREVIEW_CHUNK_BYTES;
+    opts->seed = 1;
+}
+
+const char* preview_stop_reason(PreviewStop stop) {
+    switch (stop) {
+        case PREVIEW_STOP_CONVERGED: return "converged";
+        case PREVIEW_STOP_TIME: return "time budget";
+        case PREVIEW_STOP_READS: return "read budget";
+        case PREVIEW_STOP_CANCELLED: return "cancelled";
+        default: return "end of file";
+    }
+}
+
+// One line on why the preview stopped and how much of the file it read, e.g.
+// "Preview stopped (converged) after 18 of 60 chunks: 30.2% of the file,
+// 60384 reads, 1.25s" (no newline). Returns snprintf's length.
+int preview_describe(const GenePreview* preview, char* out, size_t size) {
+    return snprintf(out, size, "Preview stopped (%s) after %u of %u chunks: %.1f%% of the file, %llu reads, %.2fs",
+                    preview_stop_reason(preview->stop), preview->chunks_done, preview->num_chunks,
+                    preview->bytes_total ? 100.0 * preview->bytes_done / preview->bytes_total : 100.0,
+                    (unsigned long long)preview->reads_done, preview->seconds);
+}
+
+static int gene_preview_init(GenePreview* preview, uint32_t num_genes) {
+    memset(preview, 0, sizeof(*preview));
+    uint32_t n = num_genes ? num_genes : 1;
+    preview->num_genes = num_genes;
+    preview->abundance = (double*)calloc(n, sizeof(double));
+    preview->ci_half = (double*)calloc(n, sizeof(double));
+    preview->last_counts = (uint64_t*)calloc(n, sizeof(uint64_t));
+    preview->sum_x2 = (double*)calloc(n, sizeof(double));
+    preview->sum_xn = (double*)calloc(n, sizeof(double));
+    if (!preview->abundance || !preview->ci_half || !preview->last_counts ||
+        !preview->sum_x2 || !preview->sum_xn) {
+        gene_preview_free(preview);
+        return -1;
+    }
+    return 0;
+}
+
+void gene_preview_free(GenePreview* preview) {
+    free(preview->abundance);
+    free(preview->ci_half);
+    free(preview->last_counts);
+    free(preview->sum_x2);
+    free(preview->sum_xn);
+    preview->abundance = preview->ci_half = preview->sum_x2 = preview->sum_xn = NULL;
+    preview->last_counts = NULL;
+}
+
+// Fold the chunk just aligned (chunk_reads reads) into the sums, then
+// refresh every estimate and interval. Returns 1 when all intervals are
+// within tolerance.
+static int preview_update(GenePreview* preview, const GeneSummary* summary, uint64_t chunk_reads,
+                          const PreviewOptions* opts) {
+    double n = (double)chunk_reads;
+    preview->sum_n2 += n * n;
+    for (uint32_t g = 0; g < preview->num_genes; g++) {
+        uint64_t x = summary->read_counts[g] - preview->last_counts[g];
+        if (x == 0) continue;
+        preview->sum_x2[g] += (double)x * x;
+        preview->sum_xn[g] += (double)x * n;
+        preview->last_counts[g] = summary->read_counts[g];
+    }
+
+    double m = preview->chunks_done;
+    double total = (double)preview->reads_done;
+    double mean_n = m > 0 ? total / m : 0;
+    double fpc = preview->num_chunks ? 1.0 - m / preview->num_chunks : 0.0;
+    int converged = 1;
+    for (uint32_t g = 0; g < preview->num_genes; g++) {
+        double p = total > 0 ? summary->read_counts[g] / total : 0.0;
+        double half = 0.0;
+        if (fpc > 0 && m < 2) {
+            half = 1.0; // No spread yet
+        } else if (fpc > 0 && mean_n > 0) {
+            // Sum over chunks of (x - p n)^2, expanded into the running sums
+            double ss = preview->sum_x2[g] - 2 * p * preview->sum_xn[g] + p * p * preview->sum_n2;
+            double var = fpc * (ss > 0 ? ss : 0) / ((m - 1) * m * mean_n * mean_n);
+            half = PREVIEW_Z * sqrt(var);
+        }
+        preview->abundance[g] = p;
+        preview->ci_half[g] = half;
+        if (half > opts->rel_tolerance * p && half > opts->abs_tolerance) converged = 0;
+    }
+    return converged;
+}
+
+// Align fastq_data chunk by chunk in a random order (single-end records),
+// folding reads into summary (initialized with gene_summary_init) and keeping
+// preview's estimates current after every chunk. Stops once the estimates
+// converge, a budget in opts is spent, align_opts->cancel fires, or every
+// chunk is aligned. align_opts->progress is called once per chunk. Returns the
+// number of reads aligned or -1; free preview with gene_preview_free either way.
+int preview_fastq(KmerIndex* index, const AlignOptions* align_opts, const PreviewOptions* opts,
+                  const char* fastq_data, size_t fastq_size, GeneSummary* summary,
+                  GenePreview* preview, AlignStats* stats) {
+    uint64_t start_ns = clock_ns();
+    if (gene_preview_init(preview, summary->num_genes) < 0) return -1;
+
+    size_t chunk_bytes = opts->chunk_bytes ? opts->chunk_bytes : PREVIEW_CHUNK_BYTES;
+    uint64_t num_chunks = fastq_size ? (fastq_size + chunk_bytes - 1) / chunk_bytes : 0;
+    if (num_chunks > UINT32_MAX) return -1;
+    preview->num_chunks = (uint32_t)num_chunks;
+    preview->bytes_total = fastq_size;
+
+    // Fisher-Yates shuffle of the chunk order
+    uint32_t* order = (uint32_t*)malloc((num_chunks ? num_chunks : 1) * sizeof(uint32_t));
+    if (!order) return -1;
+    uint64_t rng = opts->seed;
+    for (uint32_t c = 0; c < preview->num_chunks; c++) order[c] = c;
+    for (uint32_t c = preview->num_chunks; c > 1; c--) {
+        uint32_t j = (uint32_t)(splitmix64(&rng) % c);
+        uint32_t tmp = order[c - 1];
+        order[c - 1] = order[j];
+        order[j] = tmp;
+    }
+
+    // Chunks report progress here instead of one report per alignment call
+    AlignOptions chunk_opts;
+    if (align_opts) {
+        chunk_opts = *align_opts;
+    } else {
+        align_options_default(&chunk_opts);
+    }
+    chunk_opts.progress = NULL;
+    AlignStats local_stats = {0};
+    if (!stats) stats = &local_stats;
+
+    int ret = 0;
+    preview->stop = PREVIEW_STOP_END;
+    trace_begin("preview", "chunks", preview->num_chunks);
+    while (preview->chunks_done < preview->num_chunks) {
+        uint32_t c = order[preview->chunks_done];
+        size_t begin = record_start_at(fastq_data, fastq_size, (size_t)c * chunk_bytes);
+        size_t end = record_start_at(fastq_data, fastq_size, (size_t)(c + 1) * chunk_bytes);
+        uint64_t reads_before = summary->reads_total;
+        if (end > begin && align_fastq_summary(index, &chunk_opts, fastq_data + begin, end - begin,
+                                               summary, stats) < 0) {
+            ret = -1;
+            break;
+        }
+        preview->chunks_done++;
+        preview->bytes_done += end > begin ? end - begin : 0;
+        preview->reads_done = summary->reads_total;
+        preview->seconds = (clock_ns() - start_ns) / 1e9;
+
+        int converged = preview_update(preview, summary, summary->reads_total - reads_before, opts);
+        if (stats->cancelled) {
+            preview->stop = PREVIEW_STOP_CANCELLED;
+        } else if (converged && preview->chunks_done >= opts->min_chunks && preview->reads_done > 0 &&
+                   preview->chunks_done < preview->num_chunks) {
+            preview->stop = PREVIEW_STOP_CONVERGED;
+        } else if (opts->max_seconds > 0 && preview->seconds >= opts->max_seconds &&
+                   preview->chunks_done < preview->num_chunks) {
+            preview->stop = PREVIEW_STOP_TIME;
+        } else if (opts->max_reads && preview->reads_done >= opts->max_reads &&
+                   preview->chunks_done < preview->num_chunks) {
+            preview->stop = PREVIEW_STOP_READS;
+        }
+
+        if (align_opts && align_opts->progress) {
+            AlignProgress progress = {preview->reads_done, preview->bytes_done, fastq_size, preview->seconds,
+                                      preview->seconds > 0 ? preview->reads_done / preview->seconds : 0.0, 0};
+            progress.done = preview->stop != PREVIEW_STOP_END || preview->chunks_done == preview->num_chunks;
+            align_opts->progress(&progress, align_opts->progress_user_data);
+        }
+        if (preview->stop != PREVIEW_STOP_END) break;
+    }
+    trace_end("preview", "chunks_done", preview->chunks_done);
+
+    free(order);
+    return ret < 0 ? -1 : (int)preview->reads_done;
+}
@@ -1,6 +1,7 @@
 #include "swiftamr.h"
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
 
 // Nucleotide encoding: A=0, C=1, G=2, T=3
 static inline int nt_to_int(char c) {
@@ -32,13 +33,113 @@ uint64_t kmer_encode(const char* seq) {
     return kmer;
 }
 
-// Create new k-mer index
-KmerIndex* index_create(void) {
+// Reverse complement of seq[0..len) into out; qual (may be NULL) is reversed
+// into out_qual. Anything other than ACGT becomes N.
+void reverse_complement(const char* seq, const char* qual, uint32_t len, char* out, char* out_qual) {
+    static const char complement[4] = {'T', 'G', 'C', 'A'};
+    for (uint32_t i = 0; i < len; i++) {
+        int nt = nt_to_int(seq[len - 1 - i]);
+        out[i] = nt < 0 ? 'N' : complement[nt];
+        if (qual) out_qual[i] = qual[len - 1 - i];
+    }
+    out[len] = '\0';
+    if (qual) out_qual[len] = '\0';
+}
+
+void arena_init(Arena* arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size;
+    arena->bytes_allocated = 0;
+}
+
+// Allocate size bytes (8-byte aligned); requests larger than a block get their own block
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock* block = arena->head;
+
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        size_t header = (sizeof(ArenaBlock) + 7) & ~(size_t)7;
+        block = (ArenaBlock*)malloc(header + block_size);
+        if (!block) return NULL;
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+        arena->bytes_allocated += header + block_size;
+    }
+
+    void* ptr = (char*)block + ((sizeof(ArenaBlock) + 7) & ~(size_t)7) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_destroy(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->bytes_allocated = 0;
+}
+
+// Default index options: no capping, no masking
+void index_options_default(IndexOptions* opts) {
+    opts->max_kmer_hits = 0;
+    opts->cap_mode = KMER_CAP_DROP;
+    opts->dust_window = 0;
+    opts->dust_threshold = DUST_THRESHOLD;
+    opts->kmer_stride = 1;
+    opts->expected_kmers = 0;
+    opts->max_memory = 0;
+}
+
+// Smallest power-of-two table holding expected_kmers at HASH_TABLE_MAX_LOAD
+static uint32_t table_size_for(uint64_t expected_kmers) {
+    uint32_t size = HASH_TABLE_MIN_SIZE;
+    while (size < HASH_TABLE_MAX_SIZE && (uint64_t)size * HASH_TABLE_MAX_LOAD < expected_kmers) {
+        size <<= 1;
+    }
+    return size;
+}
+
+// Fibonacci hashing: multiply and keep the top table_bits bits
+static inline uint32_t kmer_bucket(const KmerIndex* index, uint64_t kmer) {
+    return (uint32_t)((kmer * 0x9E3779B97F4A7C15ULL) >> (64 - index->table_bits));
+}
+
+// Pack a sequence 32 bases per word. Returns 0 if it contains a non-ACGT base.
+int pack_sequence(const char* seq, uint32_t len, uint64_t* packed) {
+    memset(packed, 0, PACKED_WORDS(len) * sizeof(uint64_t));
+    for (uint32_t i = 0; i < len; i++) {
+        int nt = nt_to_int(seq[i]);
+        if (nt < 0) return 0;
+        packed[i / 32] |= (uint64_t)nt << (62 - 2 * (i % 32));
+    }
+    return 1;
+}
+
+// Create new k-mer index (opts may be NULL for defaults)
+KmerIndex* index_create(const IndexOptions* opts) {
     KmerIndex* index = (KmerIndex*)calloc(1, sizeof(KmerIndex));
     if (!index) return NULL;
 
-    index->table_size = HASH_TABLE_SIZE;
-    index->table = (KmerEntry**)calloc(HASH_TABLE_SIZE, sizeof(KmerEntry*));
+    if (opts) {
+        index->options = *opts;
+    } else {
+        index_options_default(&index->options);
+    }
+
+    arena_init(&index->entry_arena, ARENA_BLOCK_SIZE);
+    arena_init(&index->hit_arena, ARENA_BLOCK_SIZE);
+
+    if (index->options.kmer_stride == 0) index->options.kmer_stride = 1;
+
+    index->table_size = table_size_for(index->options.expected_kmers);
+    index->table_bits = __builtin_ctz(index->table_size);
+    index->table = (KmerEntry**)calloc(index->table_size, sizeof(KmerEntry*));
     if (!index->table) {
         free(index);
         return NULL;
@@ -60,36 +161,57 @@ KmerIndex* index_create(void) {
 void index_destroy(KmerIndex* index) {
     if (!index) return;
 
-    // Free hash table
-    if (index->table) {
-        for (uint32_t i = 0; i < index->table_size; i++) {
-            KmerEntry* entry = index->table[i];
-            while (entry) {
-                KmerEntry* next = entry->next;
-                if (entry->hits) free(entry->hits);
-                free(entry);
-                entry = next;
-            }
-        }
-        free(index->table);
-    }
+    // Free hash table; entries and hit lists are owned by the arenas
+    free(index->table);
+    arena_destroy(&index->entry_arena);
+    arena_destroy(&index->hit_arena);
+    free(index->hit_pool);
+    free(index->hit_counts);
 
     // Free genes
-    if (index->genes) {
-        for (uint32_t i = 0; i < index->num_genes; i++) {
-            if (index->genes[i].sequence) {
-                free(index->genes[i].sequence);
-            }
+    free(index->genes);
+    free(index->name_pool);
+    free(index->seq_arena);
+    free(index->n_runs);
+
+    free(index);
+}
+
+// Rehash all entries into a table of table_size buckets (a power of two)
+int index_resize_table(KmerIndex* index, uint32_t table_size) {
+    KmerEntry** table = (KmerEntry**)calloc(table_size, sizeof(KmerEntry*));
+    if (!table) return -1;
+
+    KmerEntry** old_table = index->table;
+    uint32_t old_size = index->table_size;
+    index->table = table;
+    index->table_size = table_size;
+    index->table_bits = __builtin_ctz(table_size);
+
+    for (uint32_t i = 0; i < old_size; i++) {
+        KmerEntry* entry = old_table[i];
+        while (entry) {
+            KmerEntry* next = entry->next;
+            uint32_t bucket = kmer_bucket(index, entry->kmer);
+            entry->next = table[bucket];
+            table[bucket] = entry;
+            entry = next;
         }
-        free(index->genes);
     }
 
-    free(index);
+    free(old_table);
+    return 0;
 }
 
-// Add k-mer to index
-void kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32_t position) {
-    uint32_t hash = kmer % index->table_size;
+// Add k-mer to index. Returns -1 if memory runs out.
+int kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32_t position) {
+    // Grow before the chains get long; on failure keep the current table
+    if (index->stats.distinct_kmers >= (uint64_t)index->table_size * HASH_TABLE_MAX_LOAD &&
+        index->table_size < HASH_TABLE_MAX_SIZE) {
+        index_resize_table(index, index->table_size * 2);
+    }
+
+    uint32_t hash = kmer_bucket(index, kmer);
 
     // Find or create entry
     KmerEntry* entry = index->table[hash];
@@ -102,12 +224,14 @@ void kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32
 
     if (!entry) {
         // Create new entry
-        entry = (KmerEntry*)calloc(1, sizeof(KmerEntry));
+        entry = (KmerEntry*)arena_alloc(&index->entry_arena, sizeof(KmerEntry));
+        if (!entry) return -1;
         entry->kmer = kmer;
-        entry->capacity = 4;
-        entry->hits = (KmerHit*)malloc(entry->capacity * sizeof(KmerHit));
+        entry->capacity = 0;
+        entry->hits = NULL;
         entry->num_hits = 0;
         entry->next = NULL;
+        index->stats.distinct_kmers++;
 
         if (prev) {
             prev->next = entry;
@@ -116,20 +240,26 @@ void kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32
         }
     }
 
-    // Add hit to entry
+    // Add hit to entry; a full list moves to a block twice the size and the
+    // old one is left in the arena until index_finalize compacts the lists
     if (entry->num_hits >= entry->capacity) {
-        entry->capacity *= 2;
-        entry->hits = (KmerHit*)realloc(entry->hits, entry->capacity * sizeof(KmerHit));
+        uint32_t capacity = entry->capacity ? entry->capacity * 2 : 1;
+        KmerHit* hits = (KmerHit*)arena_alloc(&index->hit_arena, capacity * sizeof(KmerHit));
+        if (!hits) return -1;
+        if (entry->num_hits) memcpy(hits, entry->hits, entry->num_hits * sizeof(KmerHit));
+        entry->hits = hits;
+        entry->capacity = capacity;
     }
 
     entry->hits[entry->num_hits].gene_id = gene_id;
     entry->hits[entry->num_hits].position = position;
     entry->num_hits++;
+    return 0;
 }
 
 // Lookup k-mer in index
 KmerEntry* kmer_lookup(KmerIndex* index, uint64_t kmer) {
-    uint32_t hash = kmer % index->table_size;
+    uint32_t hash = kmer_bucket(index, kmer);
     KmerEntry* entry = index->table[hash];
 
     while (entry && entry->kmer != kmer) {
@@ -139,7 +269,154 @@ KmerEntry* kmer_lookup(KmerIndex* index, uint64_t kmer) {
     return entry;
 }
 
-// Add gene to index
+// kmer_lookup that also counts the chain entries it compares
+static inline KmerEntry* kmer_lookup_counted(const KmerIndex* index, uint64_t kmer, uint64_t* probes) {
+    KmerEntry* entry = index->table[kmer_bucket(index, kmer)];
+    while (entry) {
+        (*probes)++;
+        if (entry->kmer == kmer) break;
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Monotonic clock in nanoseconds
+uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Triplet code (0-63) starting at seq, or -1 if it contains an invalid base
+static inline int triplet_code(const char* seq) {
+    int a = nt_to_int(seq[0]), b = nt_to_int(seq[1]), c = nt_to_int(seq[2]);
+    if (a < 0 || b < 0 || c < 0) return -1;
+    return (a << 4) | (b << 2) | c;
+}
+
+// DUST-style low-complexity masking. A window scores sum(c*(c-1)/2) / (l-1)
+// over its l triplet counts c; windows scoring above threshold are masked.
+// Returns the number of bases newly marked in mask.
+static uint64_t dust_mask(const char* seq, uint32_t len, uint32_t window,
+                          float threshold, uint8_t* mask) {
+    if (len < 3 || window < 4) return 0;
+    if (window > len) window = len;
+
+    uint32_t counts[64] = {0};
+    uint32_t score_sum = 0;   // sum of c*(c-1)/2 over the current window
+    uint32_t num_triplets = 0;
+    uint32_t masked_until = 0;
+    uint64_t masked = 0;
+
+    for (uint32_t end = 0; end + 2 < len; end++) {
+        // Add triplet entering the window
+        int t = triplet_code(&seq[end]);
+        if (t >= 0) {
+            score_sum += counts[t]++;
+            num_triplets++;
+        }
+
+        // Remove triplet leaving the window (window covers window - 2 triplets)
+        if (end >= window - 2) {
+            int old = triplet_code(&seq[end - (window - 2)]);
+            if (old >= 0) {
+                score_sum -= --counts[old];
+                num_triplets--;
+            }
+        }
+
+        if (end + 3 < window || num_triplets < 2) continue;
+
+        float score = (float)score_sum / (num_triplets - 1);
+        if (score > threshold) {
+            uint32_t start = end + 3 - window;
+            uint32_t stop = end + 3;
+            if (start < masked_until) start = masked_until;
+            for (uint32_t p = start; p < stop; p++) mask[p] = 1;
+            masked += stop - start;
+            masked_until = stop;
+        }
+    }
+
+    return masked;
+}
+
+// Append a name (plus NUL) to the shared string pool
+static int name_pool_append(KmerIndex* index, const char* name, uint32_t length) {
+    if (index->name_pool_size + length + 1 > index->name_pool_capacity) {
+        uint32_t capacity = index->name_pool_capacity ? index->name_pool_capacity : 16384;
+        while (index->name_pool_size + length + 1 > capacity) capacity *= 2;
+        char* pool = (char*)realloc(index->name_pool, capacity);
+        if (!pool) return -1;
+        index->name_pool = pool;
+        index->name_pool_capacity = capacity;
+    }
+    memcpy(index->name_pool + index->name_pool_size, name, length);
+    index->name_pool[index->name_pool_size + length] = '\0';
+    index->name_pool_size += length + 1;
+    return 0;
+}
+
+// Pack a gene onto the end of the sequence arena. Non-ACGT bases are stored
+// as A and recorded as runs in index->n_runs.
+static int seq_arena_append(KmerIndex* index, Gene* gene, const char* sequence) {
+    uint64_t needed = PACKED_WORDS(index->seq_arena_bases + gene->length) + 1;
+    if (needed > index->seq_arena_words) {
+        uint64_t words = index->seq_arena_words ? index->seq_arena_words : 4096;
+        while (words < needed) words *= 2;
+        uint64_t* arena = (uint64_t*)realloc(index->seq_arena, words * sizeof(uint64_t));
+        if (!arena) return -1;
+        memset(arena + index->seq_arena_words, 0, (words - index->seq_arena_words) * sizeof(uint64_t));
+        index->seq_arena = arena;
+        index->seq_arena_words = words;
+    }
+
+    gene->seq_offset = index->seq_arena_bases;
+    for (uint32_t i = 0; i < gene->length; i++) {
+        int nt = nt_to_int(sequence[i]);
+        if (nt < 0) {
+            NRun* last = gene->n_runs_count ? &index->n_runs[index->num_n_runs - 1] : NULL;
+            if (last && last->start + last->length == i) {
+                last->length++;
+            } else {
+                if (index->num_n_runs >= index->n_runs_capacity) {
+                    uint32_t capacity = index->n_runs_capacity ? index->n_runs_capacity * 2 : 64;
+                    NRun* runs = (NRun*)realloc(index->n_runs, capacity * sizeof(NRun));
+                    if (!runs) return -1;
+                    index->n_runs = runs;
+                    index->n_runs_capacity = capacity;
+                }
+                index->n_runs[index->num_n_runs].start = i;
+                index->n_runs[index->num_n_runs].length = 1;
+                index->num_n_runs++;
+                gene->n_runs_count++;
+            }
+            continue;
+        }
+        uint64_t b = gene->seq_offset + i;
+        index->seq_arena[b / 32] |= (uint64_t)nt << (62 - 2 * (b % 32));
+    }
+    index->seq_arena_bases += gene->length;
+    return 0;
+}
+
+// Gene name (NUL-terminated, owned by the index)
+const char* index_gene_name(const KmerIndex* index, uint32_t gene_id) {
+    return index->name_pool + index->genes[gene_id].name_offset;
+}
+
+// Base at pos of a gene: 0-3 for ACGT, -1 inside an N run
+int index_gene_base(const KmerIndex* index, uint32_t gene_id, uint32_t pos) {
+    const Gene* gene = &index->genes[gene_id];
+    for (uint32_t r = 0; r < gene->n_runs_count; r++) {
+        const NRun* run = &index->n_runs[gene->n_runs_start + r];
+        if (pos >= run->start && pos < run->start + run->length) return -1;
+    }
+    uint64_t b = gene->seq_offset + pos;
+    return (int)((index->seq_arena[b / 32] >> (62 - 2 * (b % 32))) & 3);
+}
+
+// Add gene to index. Returns its gene id, or -1 if memory runs out.
 int index_add_gene(KmerIndex* index, const char* name, const char* sequence) {
     if (index->num_genes >= index->genes_capacity) {
         index->genes_capacity *= 2;
@@ -150,37 +427,163 @@ int index_add_gene(KmerIndex* index, const char* name, const char* sequence) {
     uint32_t gene_id = index->num_genes;
     Gene* gene = &index->genes[gene_id];
 
-    strncpy(gene->name, name, MAX_GENE_NAME - 1);
-    gene->name[MAX_GENE_NAME - 1] = '\0';
+    uint32_t name_length = strlen(name);
+    if (name_length > MAX_GENE_NAME - 1) name_length = MAX_GENE_NAME - 1;
+    gene->name_offset = index->name_pool_size;
+    gene->name_length = name_length;
+    if (name_pool_append(index, name, name_length) < 0) return -1;
 
     gene->length = strlen(sequence);
-    gene->sequence = (char*)malloc(gene->length + 1);
-    if (!gene->sequence) return -1;
-    strcpy(gene->sequence, sequence);
+    gene->n_runs_start = index->num_n_runs;
+    gene->n_runs_count = 0;
+    if (seq_arena_append(index, gene, sequence) < 0) return -1;
+
+    if (gene->length < KMER_SIZE) {
+        index->num_genes++;
+        return gene_id;
+    }
+
+    // Low-complexity mask (NULL when masking is disabled)
+    uint8_t* mask = NULL;
+    if (index->options.dust_window > 0) {
+        mask = (uint8_t*)calloc(gene->length, 1);
+        if (!mask) return -1;
+        index->stats.masked_bases += dust_mask(sequence, gene->length,
+                                               index->options.dust_window,
+                                               index->options.dust_threshold, mask);
+    }
 
     // Add all k-mers from this gene
+    int64_t last_masked = -1;
+    for (uint32_t i = 0; i < KMER_SIZE - 1 && mask; i++) {
+        if (mask[i]) last_masked = i;
+    }
+
+    // Only sampled positions count as masked, so masked_kmers stays a
+    // number of k-mers that would otherwise have been indexed
+    uint32_t stride = index->options.kmer_stride;
     for (uint32_t i = 0; i <= gene->length - KMER_SIZE; i++) {
+        if (mask && mask[i + KMER_SIZE - 1]) last_masked = i + KMER_SIZE - 1;
+        if (i % stride != 0) continue;
+        if (last_masked >= (int64_t)i) {
+            index->stats.masked_kmers++;
+            continue;
+        }
         if (kmer_is_valid(&sequence[i])) {
             uint64_t kmer = kmer_encode(&sequence[i]);
-            if (kmer != UINT64_MAX) {
-                kmer_add_to_index(index, kmer, gene_id, i);
+            if (kmer != UINT64_MAX && kmer_add_to_index(index, kmer, gene_id, i) < 0) {
+                free(mask);
+                return -1;
             }
         }
     }
 
+    free(mask);
+
     index->num_genes++;
     return gene_id;
 }
 
-// Parse FASTA and build index
+// Upper bound on index memory for a database: every sampled k-mer distinct
+uint64_t index_estimate_memory(uint64_t num_bases, uint32_t num_genes, uint32_t kmer_stride) {
+    uint64_t kmers = num_bases / (kmer_stride ? kmer_stride : 1);
+    uint64_t table = (uint64_t)table_size_for(kmers) * sizeof(KmerEntry*);
+    uint64_t entries = kmers * (sizeof(KmerEntry) + sizeof(KmerHit));
+    uint64_t genes = (uint64_t)num_genes * (sizeof(Gene) + MAX_GENE_NAME / 4);
+    return table + entries + genes + num_bases / 4 + num_bases; // Packed bases and hit_counts
+}
+
+// Pre-scan a FASTA: total sequence bases, record count and longest record
+static uint64_t fasta_scan(const char* fasta_data, size_t fasta_size,
+                           uint32_t* num_records, uint32_t* max_length) {
+    uint64_t total = 0, current = 0;
+    *num_records = 0;
+    *max_length = 0;
+
+    for (size_t i = 0; i < fasta_size; i++) {
+        if (fasta_data[i] == '>') {
+            (*num_records)++;
+            if (current > *max_length) *max_length = current;
+            current = 0;
+            while (i < fasta_size && fasta_data[i] != '\n') i++;
+        } else if (!isspace(fasta_data[i])) {
+            current++;
+            total++;
+        }
+    }
+    if (current > *max_length) *max_length = current;
+    return total;
+}
+
+// 64-bit hash of a byte string (same mixing as read_fingerprint, 8 bytes per step)
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t h = seed + size * prime1;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        k *= prime2;
+        k = (k << 31) | (k >> 33);
+        h ^= k * prime1;
+        h = ((h << 27) | (h >> 37)) * prime1 + prime2;
+    }
+    for (; size > 0; p++, size--) {
+        h ^= *p * prime1;
+        h = ((h << 11) | (h >> 53)) * prime2;
+    }
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// Content hash identifying the index that opts would build from a FASTA:
+// equal hashes mean an already built index can be reused
+uint64_t index_source_hash(const IndexOptions* opts, const char* fasta_data, size_t fasta_size) {
+    uint64_t fields[7] = {
+        KMER_SIZE, opts->max_kmer_hits, (uint64_t)opts->cap_mode, opts->dust_window, 0,
+        opts->kmer_stride, opts->max_memory
+    };
+    float dust_threshold = opts->dust_window ? opts->dust_threshold : 0.0f;
+    memcpy(&fields[4], &dust_threshold, sizeof(float));
+    return hash_bytes(fasta_data, fasta_size, hash_bytes(fields, sizeof(fields), 0));
+}
+
+// Parse FASTA and build index. Returns the number of genes added, or -1 if
+// the memory budget cannot be met or memory runs out.
 int index_build_from_fasta(KmerIndex* index, const char* fasta_data, size_t fasta_size) {
     char gene_name[MAX_GENE_NAME] = {0};
-    char* sequence = (char*)malloc(MAX_SEQUENCE_LENGTH);
+    index->source_hash = index_source_hash(&index->options, fasta_data, fasta_size);
+
+    // Size the table and sequence buffer from the database itself
+    uint32_t num_records, max_length;
+    trace_begin("fasta_scan", "bytes", fasta_size);
+    uint64_t num_bases = fasta_scan(fasta_data, fasta_size, &num_records, &max_length);
+    trace_end("fasta_scan", "records", num_records);
+    if (max_length > MAX_SEQUENCE_LENGTH - 1) max_length = MAX_SEQUENCE_LENGTH - 1;
+
+    // Under a memory budget, sample reference k-mers more sparsely until the
+    // worst-case estimate fits
+    if (index->options.max_memory > 0) {
+        while (index_estimate_memory(num_bases, num_records, index->options.kmer_stride) >
+               index->options.max_memory) {
+            if (index->options.kmer_stride >= MAX_KMER_STRIDE) return -1;
+            index->options.kmer_stride *= 2;
+        }
+    }
+
+    uint32_t table_size = table_size_for(num_bases / index->options.kmer_stride);
+    if (table_size > index->table_size && index_resize_table(index, table_size) < 0) return -1;
+
+    char* sequence = (char*)malloc(max_length + 1);
     if (!sequence) return -1;
 
     uint32_t seq_pos = 0;
     int in_sequence = 0;
     int genes_added = 0;
+    trace_begin("fasta_parse", "bytes", fasta_size);
 
     for (size_t i = 0; i < fasta_size; i++) {
         char c = fasta_data[i];
@@ -189,9 +592,11 @@ int index_build_from_fasta(KmerIndex* index, const char* fasta_data, size_t fast
             // Save previous gene if exists
             if (in_sequence && seq_pos > 0) {
                 sequence[seq_pos] = '\0';
-                if (index_add_gene(index, gene_name, sequence) >= 0) {
-                    genes_added++;
+                if (index_add_gene(index, gene_name, sequence) < 0) {
+                    genes_added = -1;
+                    break;
                 }
+                genes_added++;
                 seq_pos = 0;
             }
 
@@ -209,163 +614,816 @@ int index_build_from_fasta(KmerIndex* index, const char* fasta_data, size_t fast
             gene_name[name_pos] = '\0';
 
         } else if (in_sequence && !isspace(c)) {
-            if (seq_pos < MAX_SEQUENCE_LENGTH - 1) {
+            if (seq_pos < max_length) {
                 sequence[seq_pos++] = toupper(c);
             }
         }
     }
 
     // Add last gene
-    if (in_sequence && seq_pos > 0) {
+    if (genes_added >= 0 && in_sequence && seq_pos > 0) {
         sequence[seq_pos] = '\0';
-        if (index_add_gene(index, gene_name, sequence) >= 0) {
-            genes_added++;
-        }
+        genes_added = index_add_gene(index, gene_name, sequence) < 0 ? -1 : genes_added + 1;
     }
 
     free(sequence);
+    trace_end("fasta_parse", "genes", genes_added);
     return genes_added;
 }
 
-// Align a single read using winner-takes-all strategy
-ReadAlignment* align_read(KmerIndex* index, const char* read_name, const char* sequence, uint32_t seq_len) {
-    if (seq_len < KMER_SIZE) return NULL;
+// 32 bases starting at base pos of a packed sequence (needs one padding word)
+static inline uint64_t packed_window(const uint64_t* packed, uint64_t pos) {
+    uint64_t w = pos / 32;
+    uint32_t off = pos % 32;
+    uint64_t bases = packed[w] << (2 * off);
+    if (off) bases |= packed[w + 1] >> (64 - 2 * off);
+    return bases;
+}
+
+// Fill index->hit_counts from the final hit lists. Seed extension reads it to
+// stop where a lookup would have scored differently. Left NULL (extension
+// off) if memory runs out.
+static void index_fill_hit_counts(KmerIndex* index) {
+    free(index->hit_counts);
+    index->hit_counts = (uint8_t*)calloc(index->seq_arena_bases ? index->seq_arena_bases : 1, 1);
+    if (!index->hit_counts) return;
+
+    for (uint32_t i = 0; i < index->table_size; i++) {
+        for (const KmerEntry* entry = index->table[i]; entry; entry = entry->next) {
+            uint8_t count = entry->num_hits < HIT_COUNT_OTHER ? entry->num_hits : HIT_COUNT_OTHER;
+            for (uint32_t h = 0; h < entry->num_hits; h++) {
+                const KmerHit* hit = &entry->hits[h];
+                index->hit_counts[index->genes[hit->gene_id].seq_offset + hit->position] = count;
+            }
+        }
+    }
+
+    // Occurrences left out by stride, masking or capping: is the k-mer
+    // indexed elsewhere? K-mers across N runs are never extended into.
+    for (uint32_t g = 0; g < index->num_genes; g++) {
+        const Gene* gene = &index->genes[g];
+        uint32_t r = 0;
+        for (uint32_t i = 0; i + KMER_SIZE <= gene->length; i++) {
+            while (r < gene->n_runs_count &&
+                   index->n_runs[gene->n_runs_start + r].start + index->n_runs[gene->n_runs_start + r].length <= i) {
+                r++;
+            }
+            if (r < gene->n_runs_count && index->n_runs[gene->n_runs_start + r].start < i + KMER_SIZE) continue;
+
+            uint64_t b = gene->seq_offset + i;
+            if (index->hit_counts[b]) continue;
+            uint64_t kmer = packed_window(index->seq_arena, b) >> (64 - 2 * KMER_SIZE);
+            if (kmer_lookup(index, kmer)) index->hit_counts[b] = HIT_COUNT_OTHER;
+        }
+    }
+}
 
-    ReadAlignment* result = (ReadAlignment*)calloc(1, sizeof(ReadAlignment));
-    result->read_name = strdup(read_name);
+// Apply the high-frequency k-mer limit once all genes have been added
+void index_finalize(KmerIndex* index) {
+    uint32_t limit = index->options.max_kmer_hits;
+    trace_begin("index_finalize", NULL, 0);
+
+    for (uint32_t i = 0; i < index->table_size; i++) {
+        KmerEntry** link = &index->table[i];
+        while (*link) {
+            KmerEntry* entry = *link;
+            if (entry->num_hits > index->stats.max_hits_seen) {
+                index->stats.max_hits_seen = entry->num_hits;
+            }
 
-    // Score array for all genes
-    uint32_t* scores = (uint32_t*)calloc(index->num_genes, sizeof(uint32_t));
-    uint32_t* coverage_bitmap = (uint32_t*)calloc(index->num_genes * ((MAX_SEQUENCE_LENGTH / 32) + 1), sizeof(uint32_t));
+            if (limit == 0 || entry->num_hits <= limit) {
+                link = &entry->next;
+                continue;
+            }
+
+            index->stats.capped_kmers++;
+            if (index->options.cap_mode == KMER_CAP_TRUNCATE) {
+                index->stats.capped_hits += entry->num_hits - limit;
+                entry->num_hits = limit;
+                link = &entry->next;
+            } else {
+                // Unlinked entries stay in the arena until index_destroy
+                index->stats.capped_hits += entry->num_hits;
+                index->stats.distinct_kmers--;
+                *link = entry->next;
+            }
+        }
+    }
+
+    // Compact all hit lists into one array and release the build-time blocks
+    uint64_t total_hits = 0;
+    for (uint32_t i = 0; i < index->table_size; i++) {
+        for (KmerEntry* entry = index->table[i]; entry; entry = entry->next) {
+            total_hits += entry->num_hits;
+        }
+    }
+
+    KmerHit* pool = (KmerHit*)malloc((total_hits ? total_hits : 1) * sizeof(KmerHit));
+    if (!pool) {
+        trace_end("index_finalize", NULL, 0);
+        return; // Keep the uncompacted lists
+    }
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < index->table_size; i++) {
+        for (KmerEntry* entry = index->table[i]; entry; entry = entry->next) {
+            memcpy(pool + offset, entry->hits, entry->num_hits * sizeof(KmerHit));
+            entry->hits = pool + offset;
+            entry->capacity = entry->num_hits;
+            offset += entry->num_hits;
+        }
+    }
+
+    arena_destroy(&index->hit_arena);
+    free(index->hit_pool);
+    index->hit_pool = pool;
+    index->hit_pool_size = total_hits;
+    index_fill_hit_counts(index);
+    trace_end("index_finalize", "hits", total_hits);
+}
+
+// Default alignment options: no quality filtering
+void align_options_default(AlignOptions* opts) {
+    opts->min_base_quality = 0;
+    opts->min_mean_quality = 0;
+    opts->read_cache_entries = 0;
+    opts->seed_extend = 1;
+    opts->progress = NULL;
+    opts->progress_user_data = NULL;
+    opts->progress_reads = PROGRESS_INTERVAL_READS;
+    opts->progress_bytes = PROGRESS_INTERVAL_BYTES;
+    opts->cancel = NULL;
+    opts->cancel_user_data = NULL;
+}
+
+// Range of gene positions credited to a read, used for coverage of the winner
+typedef struct {
+    uint32_t gene_id;
+    uint32_t start;
+    uint32_t length;
+} CoverageRun;
+
+typedef struct {
+    CoverageRun* runs;
+    uint32_t count;
+    uint32_t capacity;
+} CoverageRuns;
+
+static int coverage_add(CoverageRuns* cov, uint32_t gene_id, uint32_t start, uint32_t length) {
+    if (cov->count >= cov->capacity) {
+        uint32_t capacity = cov->capacity ? cov->capacity * 2 : 64;
+        CoverageRun* runs = (CoverageRun*)realloc(cov->runs, capacity * sizeof(CoverageRun));
+        if (!runs) return -1;
+        cov->runs = runs;
+        cov->capacity = capacity;
+    }
+    cov->runs[cov->count].gene_id = gene_id;
+    cov->runs[cov->count].start = start;
+    cov->runs[cov->count].length = length;
+    cov->count++;
+    return 0;
+}
+
+// Number of leading bases that match between a[a_pos..] and b[b_pos..],
+// compared 32 bases per XOR
+static uint32_t packed_match_length(const uint64_t* a, uint64_t a_pos,
+                                    const uint64_t* b, uint64_t b_pos, uint32_t max_len) {
+    uint32_t matched = 0;
+    while (matched < max_len) {
+        uint64_t diff = packed_window(a, a_pos + matched) ^ packed_window(b, b_pos + matched);
+        if (diff) {
+            matched += __builtin_clzll(diff) / 2;
+            break;
+        }
+        matched += 32;
+    }
+    return matched < max_len ? matched : max_len;
+}
+
+// K-mer evidence gathered from one read, or from both mates of a pair:
+// per-gene scores and the gene ranges they cover
+typedef struct {
+    uint32_t* scores;
+    CoverageRuns cov;
+    uint32_t num_kmers;   // K-mers looked up or credited by extension
+    uint32_t read_kmers;  // K-mer positions in the read(s), for identity
+} ReadEvidence;
+
+static int evidence_init(ReadEvidence* ev, const KmerIndex* index) {
+    memset(ev, 0, sizeof(ReadEvidence));
+    ev->scores = (uint32_t*)calloc(index->num_genes ? index->num_genes : 1, sizeof(uint32_t));
+    return ev->scores ? 0 : -1;
+}
+
+static void evidence_free(ReadEvidence* ev) {
+    free(ev->scores);
+    free(ev->cov.runs);
+}
+
+// Credit gene range [position + offset, + length) to every hit of a seed
+static int coverage_add_hits(CoverageRuns* cov, const KmerEntry* entry, uint32_t offset, uint32_t length) {
+    for (uint32_t h = 0; h < entry->num_hits; h++) {
+        if (coverage_add(cov, entry->hits[h].gene_id, entry->hits[h].position + offset, length) < 0) return -1;
+    }
+    return 0;
+}
+
+// Add the k-mer hits of one read to ev. Returns -1 if memory runs out.
+static int score_read(KmerIndex* index, const char* sequence, const char* quality, uint32_t seq_len,
+                      const AlignOptions* opts, AlignStats* stats, ReadEvidence* ev) {
+    if (seq_len < KMER_SIZE) return 0;
+
+    int min_qual = (quality && opts) ? opts->min_base_quality : 0;
+    uint32_t stride = index->options.kmer_stride;
+    uint32_t* scores = ev->scores;
+    CoverageRuns* cov = &ev->cov;
+
+    // Seed-and-extend needs the read packed; it stops at the first base that
+    // is invalid or below min_base_quality (extend_limit)
+    uint64_t* packed_read = NULL;
+    uint32_t extend_limit = 0;
+    if (!opts || opts->seed_extend) {
+        packed_read = (uint64_t*)calloc(PACKED_WORDS(seq_len) + 1, sizeof(uint64_t));
+        if (!packed_read) return -1;
+        while (extend_limit < seq_len) {
+            int nt = nt_to_int(sequence[extend_limit]);
+            if (nt < 0 || (min_qual && quality[extend_limit] - PHRED_OFFSET < min_qual)) break;
+            packed_read[extend_limit / 32] |= (uint64_t)nt << (62 - 2 * (extend_limit % 32));
+            extend_limit++;
+        }
+    }
 
     uint32_t total_kmers = 0;
+    uint64_t lookups = 0, lookup_hits = 0, hits_visited = 0, probes = 0;
 
-    // Extract k-mers from read and find matches
-    for (uint32_t i = 0; i <= seq_len - KMER_SIZE; i++) {
-        if (kmer_is_valid(&sequence[i])) {
-            uint64_t kmer = kmer_encode(&sequence[i]);
-            if (kmer == UINT64_MAX) continue;
+    // Extract k-mers from read with a rolling encoder and find matches.
+    // valid_run counts consecutive ACGT bases; last_low_qual is the most
+    // recent base below min_base_quality, tracked in the same window.
+    uint64_t kmer = 0;
+    uint32_t valid_run = 0;
+    int64_t last_low_qual = -1;
+    uint32_t extended_until = 0;  // k-mers ending at or before this were credited by extension
+
+    for (uint32_t j = 0; j < seq_len; j++) {
+        int nt = nt_to_int(sequence[j]);
+        if (nt < 0) {
+            valid_run = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | nt) & KMER_MASK;
+        valid_run++;
 
-            total_kmers++;
+        if (min_qual && quality[j] - PHRED_OFFSET < min_qual) last_low_qual = j;
+        if (valid_run < KMER_SIZE) continue;
+        if (j < extended_until) continue;
+
+        uint32_t i = j + 1 - KMER_SIZE;  // k-mer start
+        if (last_low_qual >= (int64_t)i) {
+            if (stats) stats->kmers_low_quality++;
+            continue;
+        }
 
-            KmerEntry* entry = kmer_lookup(index, kmer);
-            if (entry) {
-                // Add score for each gene hit by this k-mer
-                for (uint32_t j = 0; j < entry->num_hits; j++) {
-                    uint32_t gene_id = entry->hits[j].gene_id;
-                    uint32_t pos = entry->hits[j].position;
+        total_kmers++;
+
+        KmerEntry* entry = kmer_lookup_counted(index, kmer, &probes);
+        lookups++;
+        if (!entry) continue;
+        lookup_hits++;
+        hits_visited += entry->num_hits;
+
+        // Extend every hit of this seed along its diagonal; the following
+        // k-mers that match on all diagonals are credited without lookups
+        uint32_t extension = 0;
+        if (packed_read && index->hit_counts && j < extend_limit &&
+            entry->num_hits <= SEED_EXTEND_MAX_HITS) {
+            extension = extend_limit - j - 1;
+            for (uint32_t h = 0; h < entry->num_hits && extension > 0; h++) {
+                const Gene* gene = &index->genes[entry->hits[h].gene_id];
+                uint32_t gene_next = entry->hits[h].position + KMER_SIZE;
+                uint32_t max_len = gene_next < gene->length ? gene->length - gene_next : 0;
+
+                // N runs are stored as A in the arena, so stop before the next one
+                for (uint32_t r = 0; r < gene->n_runs_count; r++) {
+                    const NRun* run = &index->n_runs[gene->n_runs_start + r];
+                    if (run->start + run->length <= gene_next) continue;
+                    uint32_t clean = run->start > gene_next ? run->start - gene_next : 0;
+                    if (clean < max_len) max_len = clean;
+                    break;
+                }
 
-                    scores[gene_id]++;
+                if (max_len > extension) max_len = extension;
+                extension = packed_match_length(packed_read, j + 1, index->seq_arena,
+                                                gene->seq_offset + gene_next, max_len);
+            }
+        }
 
-                    // Mark position as covered (for coverage calculation)
-                    uint32_t bit_idx = gene_id * ((MAX_SEQUENCE_LENGTH / 32) + 1) + (pos / 32);
-                    coverage_bitmap[bit_idx] |= (1U << (pos % 32));
+        // Walk the extended k-mers as lookups would see them. One whose
+        // occurrences on every diagonal are indexed, in hit lists as long as
+        // the seed's, has exactly the seed's hits shifted along and scores
+        // them; one absent from the index scores nothing; any other (more
+        // hits, masked or capped occurrences) ends the extension and is
+        // looked up. Covered offsets are merged into runs of [start, end).
+        uint32_t credited = 0;
+        uint32_t run_start = 0, run_end = stride;
+        if (extension > 0) {
+            const uint8_t* counts[SEED_EXTEND_MAX_HITS];
+            for (uint32_t h = 0; h < entry->num_hits; h++) {
+                counts[h] = index->hit_counts + index->genes[entry->hits[h].gene_id].seq_offset +
+                            entry->hits[h].position;
+            }
+            uint32_t d = 1;
+            for (; d <= extension; d++) {
+                uint8_t count = counts[0][d];
+                if (count != 0 && count != entry->num_hits) break;
+                uint32_t h = 1;
+                while (h < entry->num_hits && counts[h][d] == count) h++;
+                if (h < entry->num_hits) break;
+                if (count == 0) continue;
+
+                credited++;
+                if (d > run_end) {
+                    if (coverage_add_hits(cov, entry, run_start, run_end - run_start) < 0) {
+                        free(packed_read);
+                        return -1;
+                    }
+                    run_start = d;
                 }
+                run_end = d + stride;
             }
+            extension = d - 1;
+        }
+
+        for (uint32_t h = 0; h < entry->num_hits; h++) {
+            scores[entry->hits[h].gene_id] += 1 + credited;
+        }
+        if (coverage_add_hits(cov, entry, run_start, run_end - run_start) < 0) {
+            free(packed_read);
+            return -1;
+        }
+
+        if (extension > 0) {
+            total_kmers += extension;
+            extended_until = j + extension + 1;
+            if (stats) stats->kmers_extended += extension;
         }
     }
 
-    result->num_kmers_in_read = total_kmers;
+    ev->num_kmers += total_kmers;
+    ev->read_kmers += seq_len - KMER_SIZE + 1;
+    if (stats) {
+        stats->kmers_extracted += total_kmers;
+        stats->lookups += lookups;
+        stats->lookup_hits += lookup_hits;
+        stats->hits_visited += hits_visited;
+        stats->chain_probes += probes;
+    }
+    free(packed_read);
+    return 0;
+}
 
-    // Winner-takes-all: find gene with highest score
+// Winner-takes-all: the gene with the highest score, with its coverage,
+// identity and covered span
+static void pick_best_hit(const KmerIndex* index, const ReadEvidence* ev, AlignmentResult* best_hit) {
+    const uint32_t* scores = ev->scores;
+    const CoverageRuns* cov = &ev->cov;
+    uint32_t stride = index->options.kmer_stride;
     uint32_t best_gene = 0;
     uint32_t best_score = 0;
+    uint32_t ties = 0;
 
     for (uint32_t i = 0; i < index->num_genes; i++) {
         if (scores[i] > best_score) {
             best_score = scores[i];
             best_gene = i;
+            ties = 0;
+        } else if (scores[i] == best_score && best_score > 0) {
+            ties++;
         }
     }
 
     // Calculate coverage and identity for best hit
     if (best_score > 0) {
-        result->best_hit.gene_id = best_gene;
-        result->best_hit.score = best_score;
+        best_hit->gene_id = best_gene;
+        best_hit->score = best_score;
+        best_hit->ties = ties;
 
         // Calculate coverage (fraction of gene with at least one k-mer hit)
         uint32_t gene_len = index->genes[best_gene].length;
         uint32_t covered_positions = 0;
 
-        uint32_t base_idx = best_gene * ((MAX_SEQUENCE_LENGTH / 32) + 1);
-        for (uint32_t pos = 0; pos < gene_len; pos++) {
-            uint32_t bit_idx = base_idx + (pos / 32);
-            if (coverage_bitmap[bit_idx] & (1U << (pos % 32))) {
-                covered_positions++;
+        uint32_t span_start = gene_len, span_end = 0;
+
+        uint32_t* coverage_bitmap = (uint32_t*)calloc(gene_len / 32 + 1, sizeof(uint32_t));
+        for (uint32_t r = 0; coverage_bitmap && r < cov->count; r++) {
+            if (cov->runs[r].gene_id != best_gene) continue;
+            uint32_t end = cov->runs[r].start + cov->runs[r].length;
+            if (end > gene_len) end = gene_len;
+            if (cov->runs[r].start < span_start) span_start = cov->runs[r].start;
+            if (end > span_end) span_end = end;
+            for (uint32_t pos = cov->runs[r].start; pos < end; pos++) {
+                if (!(coverage_bitmap[pos / 32] & (1U << (pos % 32)))) {
+                    coverage_bitmap[pos / 32] |= (1U << (pos % 32));
+                    covered_positions++;
+                }
             }
         }
+        free(coverage_bitmap);
 
-        result->best_hit.coverage = (float)covered_positions / gene_len;
+        best_hit->coverage = (float)covered_positions / gene_len;
+        best_hit->start = span_end > span_start ? span_start : 0;
+        best_hit->end = span_end > span_start ? span_end : 0;
 
         // Estimate identity (k-mer matches / possible k-mers)
-        uint32_t max_possible_kmers = (seq_len >= gene_len) ? gene_len - KMER_SIZE + 1 : seq_len - KMER_SIZE + 1;
-        result->best_hit.identity = (float)best_score / max_possible_kmers;
-        if (result->best_hit.identity > 1.0f) result->best_hit.identity = 1.0f;
+        uint32_t max_possible_kmers = gene_len - KMER_SIZE + 1;
+        if (ev->read_kmers < max_possible_kmers) max_possible_kmers = ev->read_kmers;
+        best_hit->identity = (float)best_score * stride / max_possible_kmers;
+        if (best_hit->identity > 1.0f) best_hit->identity = 1.0f;
 
     } else {
-        result->best_hit.gene_id = UINT32_MAX; // No hit
-        result->best_hit.score = 0;
-        result->best_hit.coverage = 0.0f;
-        result->best_hit.identity = 0.0f;
+        best_hit->gene_id = UINT32_MAX; // No hit
+        best_hit->score = 0;
+        best_hit->coverage = 0.0f;
+        best_hit->identity = 0.0f;
+        best_hit->start = 0;
+        best_hit->end = 0;
+        best_hit->ties = 0;
+    }
+}
+
+// Score then pick, adding the time of each phase to stats (scaled by the
+// sampling interval) when timed is set
+static int align_evidence(KmerIndex* index, const AlignOptions* opts, AlignStats* stats, int timed,
+                          const char* seq1, const char* qual1, uint32_t len1,
+                          const char* seq2, const char* qual2, uint32_t len2,
+                          AlignmentResult* best_hit, uint32_t* num_kmers) {
+    ReadEvidence ev;
+    if (evidence_init(&ev, index) < 0) return -1;
+
+    uint64_t t0 = timed ? clock_ns() : 0;
+    int ret = score_read(index, seq1, qual1, len1, opts, stats, &ev);
+    if (ret == 0 && seq2) ret = score_read(index, seq2, qual2, len2, opts, stats, &ev);
+    uint64_t t1 = timed ? clock_ns() : 0;
+    if (ret == 0) {
+        pick_best_hit(index, &ev, best_hit);
+        *num_kmers = ev.num_kmers;
+    }
+    if (timed) {
+        stats->lookup_ns += (t1 - t0) * ALIGN_TIMING_SAMPLE;
+        stats->score_ns += (clock_ns() - t1) * ALIGN_TIMING_SAMPLE;
+    }
+    evidence_free(&ev);
+    return ret;
+}
+
+// Align a single read using winner-takes-all strategy. Fills best_hit and
+// num_kmers; returns -1 if the read is shorter than a k-mer or memory runs out.
+// quality may be NULL; opts and stats may be NULL.
+int align_read(KmerIndex* index, const char* sequence, const char* quality, uint32_t seq_len,
+               const AlignOptions* opts, AlignStats* stats,
+               AlignmentResult* best_hit, uint32_t* num_kmers) {
+    if (seq_len < KMER_SIZE) return -1;
+    return align_evidence(index, opts, stats, 0, sequence, quality, seq_len, NULL, NULL, 0,
+                          best_hit, num_kmers);
+}
+
+// Reverse-complement buffers for align_pair_timed, allocated once per call
+// for the longest mate so pairs need no allocation of their own
+typedef struct {
+    char* seq1;
+    char* qual1;
+    char* seq2;
+    char* qual2;
+} PairScratch;
+
+static int pair_scratch_init(PairScratch* scratch, size_t size1, size_t size2, int with_quality) {
+    scratch->seq1 = (char*)malloc(size1);
+    scratch->seq2 = (char*)malloc(size2);
+    scratch->qual1 = with_quality ? (char*)malloc(size1) : NULL;
+    scratch->qual2 = with_quality ? (char*)malloc(size2) : NULL;
+    if (!scratch->seq1 || !scratch->seq2 || (with_quality && (!scratch->qual1 || !scratch->qual2))) return -1;
+    return 0;
+}
+
+static void pair_scratch_free(PairScratch* scratch) {
+    free(scratch->seq1);
+    free(scratch->qual1);
+    free(scratch->seq2);
+    free(scratch->qual2);
+}
+
+// Fold one orientation's scoring counters into stats
+static void add_scoring_stats(AlignStats* stats, const AlignStats* from) {
+    stats->kmers_low_quality += from->kmers_low_quality;
+    stats->kmers_extended += from->kmers_extended;
+    stats->kmers_extracted += from->kmers_extracted;
+    stats->lookups += from->lookups;
+    stats->lookup_hits += from->lookup_hits;
+    stats->hits_visited += from->hits_visited;
+    stats->chain_probes += from->chain_probes;
+}
+
+// Align both mates of a fragment jointly: k-mer evidence from both is summed
+// before the winner is picked, so the pair gets a single decision. The index
+// holds forward strands only, so the pair is scored both as R1 with the
+// reverse complement of R2 (fragment from the forward strand) and as the
+// reverse complement of R1 with R2 (reverse strand); the higher score wins,
+// the forward orientation on a tie. Each orientation scores into its own
+// stats: only the winner's counters are kept, so a pair counts as one read,
+// while the time of both is. scratch must hold len1 and len2 bytes (and
+// qualities when qual1 or qual2 is set). Returns -1 if neither mate is as
+// long as a k-mer or memory runs out.
+static int align_pair_timed(KmerIndex* index, const char* seq1, const char* qual1, uint32_t len1,
+                            const char* seq2, const char* qual2, uint32_t len2,
+                            const AlignOptions* opts, AlignStats* stats, int timed,
+                            const PairScratch* scratch, AlignmentResult* best_hit, uint32_t* num_kmers) {
+    if (len1 < KMER_SIZE && len2 < KMER_SIZE) return -1;
+
+    AlignStats forward_stats = {0};
+    AlignStats reverse_stats = {0};
+    const AlignStats* winner_stats = &forward_stats;
+    char* rc_qual1 = qual1 ? scratch->qual1 : NULL;
+    char* rc_qual2 = qual2 ? scratch->qual2 : NULL;
+    reverse_complement(seq2, qual2, len2, scratch->seq2, rc_qual2);
+    int ret = align_evidence(index, opts, stats ? &forward_stats : NULL, timed,
+                             seq1, qual1, len1, scratch->seq2, rc_qual2, len2, best_hit, num_kmers);
+    if (ret == 0) {
+        AlignmentResult reverse_hit;
+        uint32_t reverse_kmers = 0;
+        reverse_complement(seq1, qual1, len1, scratch->seq1, rc_qual1);
+        ret = align_evidence(index, opts, stats ? &reverse_stats : NULL, timed,
+                             scratch->seq1, rc_qual1, len1, seq2, qual2, len2, &reverse_hit, &reverse_kmers);
+        if (ret == 0 && reverse_hit.score > best_hit->score) {
+            *best_hit = reverse_hit;
+            *num_kmers = reverse_kmers;
+            winner_stats = &reverse_stats;
+        }
+    }
+
+    if (stats) {
+        add_scoring_stats(stats, winner_stats);
+        stats->lookup_ns += forward_stats.lookup_ns + reverse_stats.lookup_ns;
+        stats->score_ns += forward_stats.score_ns + reverse_stats.score_ns;
+    }
+    return ret;
+}
+
+int align_pair(KmerIndex* index, const char* seq1, const char* qual1, uint32_t len1,
+               const char* seq2, const char* qual2, uint32_t len2,
+               const AlignOptions* opts, AlignStats* stats,
+               AlignmentResult* best_hit, uint32_t* num_kmers) {
+    PairScratch scratch;
+    int ret = pair_scratch_init(&scratch, (size_t)len1 + 1, (size_t)len2 + 1, qual1 || qual2);
+    if (ret == 0) {
+        ret = align_pair_timed(index, seq1, qual1, len1, seq2, qual2, len2, opts, stats, 0,
+                               &scratch, best_hit, num_kmers);
+    }
+    pair_scratch_free(&scratch);
+    return ret;
+}
+
+int gene_summary_init(GeneSummary* summary, const KmerIndex* index) {
+    memset(summary, 0, sizeof(GeneSummary));
+    uint32_t n = index->num_genes ? index->num_genes : 1;
+    summary->num_genes = index->num_genes;
+    summary->read_counts = (uint64_t*)calloc(n, sizeof(uint64_t));
+    summary->score_sums = (uint64_t*)calloc(n, sizeof(uint64_t));
+    summary->aligned_bases = (uint64_t*)calloc(n, sizeof(uint64_t));
+    summary->covered_offset = (uint64_t*)malloc((n + 1) * sizeof(uint64_t));
+    if (!summary->read_counts || !summary->score_sums || !summary->aligned_bases ||
+        !summary->covered_offset) {
+        gene_summary_free(summary);
+        return -1;
+    }
+
+    uint64_t words = 0;
+    for (uint32_t g = 0; g < index->num_genes; g++) {
+        summary->covered_offset[g] = words;
+        words += (index->genes[g].length + 63) / 64;
     }
+    summary->covered_offset[index->num_genes] = words;
 
-    free(scores);
-    free(coverage_bitmap);
+    summary->covered = (uint64_t*)calloc(words ? words : 1, sizeof(uint64_t));
+    if (!summary->covered) {
+        gene_summary_free(summary);
+        return -1;
+    }
+    return 0;
+}
+
+// Fold one read's best hit into the per-gene totals
+void gene_summary_add(GeneSummary* summary, const AlignmentResult* best_hit) {
+    summary->reads_total++;
+    if (best_hit->gene_id == UINT32_MAX) return;
+
+    uint32_t g = best_hit->gene_id;
+    summary->reads_mapped++;
+    summary->read_counts[g]++;
+    summary->score_sums[g] += best_hit->score;
+    if (best_hit->end <= best_hit->start) return;
+    summary->aligned_bases[g] += best_hit->end - best_hit->start;
+
+    // Set bits [start, end) a word at a time
+    uint64_t* bits = summary->covered + summary->covered_offset[g];
+    uint32_t first = best_hit->start / 64, last = (best_hit->end - 1) / 64;
+    uint64_t head = UINT64_MAX << (best_hit->start % 64);
+    uint64_t tail = UINT64_MAX >> (63 - (best_hit->end - 1) % 64);
+    if (first == last) {
+        bits[first] |= head & tail;
+        return;
+    }
+    bits[first] |= head;
+    for (uint32_t w = first + 1; w < last; w++) bits[w] = UINT64_MAX;
+    bits[last] |= tail;
+}
+
+// Gene bases covered by at least one read
+uint64_t gene_summary_covered_bases(const GeneSummary* summary, uint32_t gene_id) {
+    uint64_t covered = 0;
+    for (uint64_t w = summary->covered_offset[gene_id]; w < summary->covered_offset[gene_id + 1]; w++) {
+        covered += __builtin_popcountll(summary->covered[w]);
+    }
+    return covered;
+}
+
+void gene_summary_free(GeneSummary* summary) {
+    free(summary->read_counts);
+    free(summary->score_sums);
+    free(summary->aligned_bases);
+    free(summary->covered);
+    free(summary->covered_offset);
+    memset(summary, 0, sizeof(GeneSummary));
+}
+
+int result_buffer_init(ResultBuffer* results, uint32_t capacity) {
+    memset(results, 0, sizeof(ResultBuffer));
+    if (capacity == 0) capacity = 1;
+    results->capacity = capacity;
+    results->gene_id = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    results->score = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    results->coverage = (float*)malloc(capacity * sizeof(float));
+    results->identity = (float*)malloc(capacity * sizeof(float));
+    results->kmers = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    results->name_offset = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    results->name_length = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+
+    if (!results->gene_id || !results->score || !results->coverage || !results->identity ||
+        !results->kmers || !results->name_offset || !results->name_length) {
+        result_buffer_free(results);
+        return -1;
+    }
+    return 0;
+}
 
-    return result;
+// Append one row; columns are grown together when full
+int result_buffer_push(ResultBuffer* results, uint64_t name_offset, uint32_t name_length,
+                       const AlignmentResult* best_hit, uint32_t num_kmers) {
+    if (results->count >= results->capacity) {
+        ResultBuffer grown;
+        if (result_buffer_init(&grown, results->capacity * 2) < 0) return -1;
+        uint32_t n = results->count;
+        memcpy(grown.gene_id, results->gene_id, n * sizeof(uint32_t));
+        memcpy(grown.score, results->score, n * sizeof(uint32_t));
+        memcpy(grown.coverage, results->coverage, n * sizeof(float));
+        memcpy(grown.identity, results->identity, n * sizeof(float));
+        memcpy(grown.kmers, results->kmers, n * sizeof(uint32_t));
+        memcpy(grown.name_offset, results->name_offset, n * sizeof(uint64_t));
+        memcpy(grown.name_length, results->name_length, n * sizeof(uint32_t));
+        grown.count = n;
+        grown.source = results->source;
+        result_buffer_free(results);
+        *results = grown;
+    }
+
+    uint32_t row = results->count++;
+    results->gene_id[row] = best_hit->gene_id;
+    results->score[row] = best_hit->score;
+    results->coverage[row] = best_hit->coverage;
+    results->identity[row] = best_hit->identity;
+    results->kmers[row] = num_kmers;
+    results->name_offset[row] = name_offset;
+    results->name_length[row] = name_length;
+    return 0;
 }
 
-// Free alignment result
-void alignment_destroy(ReadAlignment* aln) {
-    if (!aln) return;
-    if (aln->read_name) free(aln->read_name);
-    free(aln);
+void result_buffer_free(ResultBuffer* results) {
+    free(results->gene_id);
+    free(results->score);
+    free(results->coverage);
+    free(results->identity);
+    free(results->kmers);
+    free(results->name_offset);
+    free(results->name_length);
+    memset(results, 0, sizeof(ResultBuffer));
+}
+
+// ResultBatchCallback that copies every row of batch into a ResultCollector
+void result_buffer_collect(const ResultBuffer* batch, void* user_data) {
+    ResultCollector* collector = (ResultCollector*)user_data;
+    for (uint32_t i = 0; i < batch->count && !collector->failed; i++) {
+        AlignmentResult hit = {.gene_id = batch->gene_id[i], .score = batch->score[i],
+                               .coverage = batch->coverage[i], .identity = batch->identity[i]};
+        if (result_buffer_push(collector->results, batch->name_offset[i], batch->name_length[i], &hit,
+                               batch->kmers[i]) < 0) {
+            collector->failed = 1;
+        }
+    }
 }
 
 // Print alignment result
-void print_alignment(ReadAlignment* aln, const KmerIndex* index) {
-    if (!aln) return;
+void print_alignment(const ResultBuffer* results, uint32_t row, const KmerIndex* index) {
+    if (row >= results->count) return;
 
-    printf("Read: %s\n", aln->read_name);
+    printf("Read: %.*s\n", (int)results->name_length[row], results->source + results->name_offset[row]);
 
-    if (aln->best_hit.gene_id == UINT32_MAX) {
+    if (results->gene_id[row] == UINT32_MAX) {
         printf("  No hit found\n");
     } else {
-        const Gene* gene = &index->genes[aln->best_hit.gene_id];
-        printf("  Best hit: %s\n", gene->name);
-        printf("  Score: %u k-mer matches\n", aln->best_hit.score);
-        printf("  Coverage: %.2f%%\n", aln->best_hit.coverage * 100);
-        printf("  Identity: %.2f%%\n", aln->best_hit.identity * 100);
+        printf("  Best hit: %s\n", index_gene_name(index, results->gene_id[row]));
+        printf("  Score: %u k-mer matches\n", results->score[row]);
+        printf("  Coverage: %.2f%%\n", results->coverage[row] * 100);
+        printf("  Identity: %.2f%%\n", results->identity[row] * 100);
     }
 }
 
-// Parse FASTQ and align all reads
-int align_fastq(KmerIndex* index, const char* fastq_data, size_t fastq_size,
-                ReadAlignment*** results, uint32_t* num_results) {
+// Exact-duplicate read cache: direct-mapped slots keyed by a fingerprint of
+// the packed read, verified against the stored packed sequence. Each
+// align_fastq call owns its cache, so concurrent callers never share one.
+typedef struct {
+    uint64_t fingerprint;
+    uint32_t seq_len;          // 0 = empty slot
+    uint32_t num_kmers;
+    AlignmentResult result;
+    uint64_t packed[PACKED_WORDS(READ_CACHE_MAX_LENGTH)];
+} ReadCacheSlot;
+
+typedef struct {
+    ReadCacheSlot* slots;
+    uint32_t mask;
+} ReadCache;
+
+static int read_cache_init(ReadCache* cache, uint32_t entries) {
+    uint32_t size = 1;
+    while (size < entries && size < (1U << 30)) size <<= 1;
+    cache->slots = (ReadCacheSlot*)calloc(size, sizeof(ReadCacheSlot));
+    cache->mask = size - 1;
+    return cache->slots ? 0 : -1;
+}
 
-    // Count reads first
-    uint32_t read_count = 0;
-    for (size_t i = 0; i < fastq_size; i++) {
-        if (fastq_data[i] == '@' && (i == 0 || fastq_data[i-1] == '\n')) {
-            read_count++;
-        }
+// XXH3-style fingerprint of packed words: multiply-fold each word, then avalanche
+static uint64_t read_fingerprint(const uint64_t* packed, uint32_t seq_len) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t h = seq_len * prime1;
+    for (uint32_t w = 0; w < PACKED_WORDS(seq_len); w++) {
+        uint64_t k = packed[w] * prime2;
+        k = (k << 31) | (k >> 33);
+        h ^= k * prime1;
+        h = ((h << 27) | (h >> 37)) * prime1 + prime2;
     }
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
 
-    if (read_count == 0) return 0;
-
-    *results = (ReadAlignment**)malloc(read_count * sizeof(ReadAlignment*));
-    if (!*results) return -1;
+static ReadCacheSlot* read_cache_find(ReadCache* cache, const uint64_t* packed,
+                                      uint32_t seq_len, uint64_t fingerprint) {
+    ReadCacheSlot* slot = &cache->slots[fingerprint & cache->mask];
+    if (slot->seq_len == seq_len && slot->fingerprint == fingerprint &&
+        memcmp(slot->packed, packed, PACKED_WORDS(seq_len) * sizeof(uint64_t)) == 0) {
+        return slot;
+    }
+    return NULL;
+}
 
-    *num_results = 0;
+static void read_cache_store(ReadCache* cache, const uint64_t* packed, uint32_t seq_len,
+                             uint64_t fingerprint, const AlignmentResult* result, uint32_t num_kmers) {
+    ReadCacheSlot* slot = &cache->slots[fingerprint & cache->mask];
+    slot->fingerprint = fingerprint;
+    slot->seq_len = seq_len;
+    slot->num_kmers = num_kmers;
+    slot->result = *result;
+    memcpy(slot->packed, packed, PACKED_WORDS(seq_len) * sizeof(uint64_t));
+}
 
-    char read_name[MAX_GENE_NAME];
-    char* sequence = (char*)malloc(MAX_SEQUENCE_LENGTH);
-    if (!sequence) {
-        free(*results);
-        return -1;
+// Mean Phred quality of a read (quality string of seq_len characters)
+static float mean_quality(const char* quality, uint32_t seq_len) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < seq_len; i++) {
+        // Characters below the offset are malformed; count them as Phred 0
+        // instead of wrapping the unsigned sum
+        uint8_t q = (uint8_t)quality[i];
+        sum += q > PHRED_OFFSET ? q - PHRED_OFFSET : 0;
     }
+    return seq_len ? (float)sum / seq_len : 0.0f;
+}
 
-    size_t i = 0;
+// Parse the record at or after *pos, copying the upper-cased sequence (and the
+// quality line, if quality is non-NULL) into buffers of buffer_size bytes.
+// Advances *pos past the record; returns 0 when no record is left.
+int fastq_next(const char* fastq_data, size_t fastq_size, size_t* pos,
+               char* sequence, char* quality, size_t buffer_size, FastqRecord* rec) {
+    size_t i = *pos;
     while (i < fastq_size) {
         // Parse read name
         if (fastq_data[i] != '@') {
@@ -376,14 +1434,12 @@ int align_fastq(KmerIndex* index, const char* fastq_data, size_t fastq_size,
         }
 
         i++; // Skip '@'
-        size_t name_pos = 0;
-        while (i < fastq_size && fastq_data[i] != '\n' && fastq_data[i] != ' ' && fastq_data[i] != '\t') {
-            if (name_pos < MAX_GENE_NAME - 1) {
-                read_name[name_pos++] = fastq_data[i];
-            }
+        rec->name_start = i;
+        while (i < fastq_size && fastq_data[i] != '\n' && fastq_data[i] != '\r' &&
+               fastq_data[i] != ' ' && fastq_data[i] != '\t') {
             i++;
         }
-        read_name[name_pos] = '\0';
+        rec->name_end = i;
 
         // Skip to end of line
         while (i < fastq_size && fastq_data[i] != '\n') i++;
@@ -392,29 +1448,425 @@ int align_fastq(KmerIndex* index, const char* fastq_data, size_t fastq_size,
         // Parse sequence
         size_t seq_pos = 0;
         while (i < fastq_size && fastq_data[i] != '\n' && fastq_data[i] != '+') {
-            if (!isspace(fastq_data[i]) && seq_pos < MAX_SEQUENCE_LENGTH - 1) {
+            if (!isspace(fastq_data[i]) && seq_pos < buffer_size - 1) {
                 sequence[seq_pos++] = toupper(fastq_data[i]);
             }
             i++;
         }
         sequence[seq_pos] = '\0';
 
-        // Skip quality scores (+ line and quality line)
+        // Skip + line, then read or skip the quality line
+        if (i < fastq_size && fastq_data[i] == '\n') i++; // Skip sequence newline
         while (i < fastq_size && fastq_data[i] != '\n') i++; // Skip to end of + line
         i++; // Skip newline
-        while (i < fastq_size && fastq_data[i] != '\n') i++; // Skip quality line
+        size_t qual_pos = 0;
+        while (i < fastq_size && fastq_data[i] != '\n') {
+            if (quality && !isspace(fastq_data[i]) && qual_pos < seq_pos) {
+                quality[qual_pos++] = fastq_data[i];
+            }
+            i++;
+        }
         i++; // Skip newline
 
+        // Quality filtering is skipped for records whose quality line does not match
+        rec->seq_len = (uint32_t)seq_pos;
+        rec->quality = (quality && qual_pos == seq_pos) ? quality : NULL;
+        *pos = i;
+        return 1;
+    }
+    *pos = i;
+    return 0;
+}
+
+// fastq_next, adding its time to timed_stats when that is not NULL (sampled
+// reads, see ALIGN_TIMING_SAMPLE)
+static int fastq_next_timed(const char* fastq_data, size_t fastq_size, size_t* pos,
+                            char* sequence, char* quality, size_t buffer_size, FastqRecord* rec,
+                            AlignStats* timed_stats) {
+    if (!timed_stats) return fastq_next(fastq_data, fastq_size, pos, sequence, quality, buffer_size, rec);
+    uint64_t t0 = clock_ns();
+    int more = fastq_next(fastq_data, fastq_size, pos, sequence, quality, buffer_size, rec);
+    timed_stats->parse_ns += (clock_ns() - t0) * ALIGN_TIMING_SAMPLE;
+    return more;
+}
+
+// Count a result in the hot-path counters
+static inline void count_result(AlignStats* stats, const AlignmentResult* best_hit) {
+    if (!stats) return;
+    stats->reads_aligned++;
+    if (best_hit->gene_id == UINT32_MAX) stats->reads_no_hit++;
+    if (best_hit->ties) stats->reads_tied++;
+}
+
+// Hand a full batch to the callback, timing it as output
+static inline void flush_batch(ResultBuffer* batch, ResultBatchCallback callback, void* user_data,
+                               AlignStats* stats) {
+    uint64_t t0 = stats ? clock_ns() : 0;
+    trace_begin("output_flush", "rows", batch->count);
+    callback(batch, user_data);
+    trace_end("output_flush", NULL, 0);
+    if (stats) stats->output_ns += clock_ns() - t0;
+    batch->count = 0;
+}
+
+// Next read and byte counts at which opts->progress is due
+typedef struct {
+    uint64_t start_ns;
+    uint64_t next_reads;
+    uint64_t next_bytes;
+} ProgressState;
+
+static void progress_init(ProgressState* state, const AlignOptions* opts) {
+    state->start_ns = clock_ns();
+    state->next_reads = opts->progress_reads ? opts->progress_reads : UINT64_MAX;
+    state->next_bytes = opts->progress_bytes ? opts->progress_bytes : UINT64_MAX;
+}
+
+static void progress_report(const AlignOptions* opts, ProgressState* state,
+                            uint64_t reads, uint64_t bytes, uint64_t total_bytes, int done) {
+    AlignProgress progress;
+    progress.reads = reads;
+    progress.bytes = bytes < total_bytes ? bytes : total_bytes;
+    progress.total_bytes = total_bytes;
+    progress.seconds = (clock_ns() - state->start_ns) / 1e9;
+    progress.reads_per_sec = progress.seconds > 0 ? reads / progress.seconds : 0.0;
+    progress.done = done;
+    opts->progress(&progress, opts->progress_user_data);
+
+    while (state->next_reads <= reads) state->next_reads += opts->progress_reads;
+    while (state->next_bytes <= bytes) state->next_bytes += opts->progress_bytes;
+}
+
+// Poll opts->cancel once every CANCEL_CHECK_READS records. The caller breaks
+// out of its read loop and takes the normal exit path, so the partial batch is
+// flushed and the working buffers are freed; the index is not touched.
+static inline int align_cancelled(const AlignOptions* opts, uint64_t records, int* cancelled) {
+    if (!opts || !opts->cancel || records % CANCEL_CHECK_READS != 0) return 0;
+    if (!opts->cancel(opts->cancel_user_data)) return 0;
+    trace_begin("cancelled", "records", records);
+    trace_end("cancelled", NULL, 0);
+    *cancelled = 1;
+    return 1;
+}
+
+// Trace spans of RESULT_BATCH_ROWS results: a span opens before the first
+// read of a batch and closes once the batch is full or the input ends
+static inline void batch_span_open(int* open) {
+    if (*open) return;
+    trace_begin("align_batch", NULL, 0);
+    *open = 1;
+}
+
+static inline void batch_span_close(int* open, uint32_t results) {
+    if (!*open) return;
+    trace_end("align_batch", "results", results);
+    *open = 0;
+}
+
+// Parse FASTQ and align all reads. Each result is either folded into summary
+// or batched for callback (batch is then unused). Returns the number of aligned
+// reads, or -1 if memory runs out.
+static int align_fastq_reads(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                             ResultBatchCallback callback, void* user_data, GeneSummary* summary,
+                             AlignStats* stats) {
+
+    uint64_t start_ns = stats ? clock_ns() : 0;
+    int use_quality = opts && (opts->min_base_quality || opts->min_mean_quality);
+    uint32_t total_results = 0;
+
+    ResultBuffer batch = {0};
+    if (!summary && result_buffer_init(&batch, RESULT_BATCH_ROWS) < 0) return -1;
+    batch.source = fastq_data;
+
+    // Results depend on base qualities when min_base_quality is set, so the
+    // sequence alone is not a valid cache key in that mode
+    ReadCache cache = {NULL, 0};
+    if (opts && opts->read_cache_entries && !opts->min_base_quality) {
+        if (read_cache_init(&cache, opts->read_cache_entries) < 0) {
+            result_buffer_free(&batch);
+            return -1;
+        }
+    }
+    uint64_t packed[PACKED_WORDS(READ_CACHE_MAX_LENGTH)];
+
+    size_t buffer_size = fastq_size < MAX_SEQUENCE_LENGTH ? fastq_size + 1 : MAX_SEQUENCE_LENGTH;
+    char* sequence = (char*)malloc(buffer_size);
+    char* quality = use_quality ? (char*)malloc(buffer_size) : NULL;
+    if (!sequence || (use_quality && !quality)) {
+        free(sequence);
+        free(quality);
+        free(cache.slots);
+        result_buffer_free(&batch);
+        return -1;
+    }
+
+    FastqRecord rec;
+    size_t pos = 0;
+    uint64_t reads_seen = 0;
+    int timed = stats != NULL;  // The record being parsed is a timing sample
+    int batch_span = 0;
+    int cancelled = 0;
+    int ret = 0;
+    ProgressState progress;
+    if (opts && opts->progress) progress_init(&progress, opts);
+    trace_begin("fastq_chunk", "bytes", fastq_size);
+    while (!align_cancelled(opts, reads_seen, &cancelled) &&
+           fastq_next_timed(fastq_data, fastq_size, &pos, sequence, quality, buffer_size, &rec,
+                            timed ? stats : NULL)) {
+        batch_span_open(&batch_span);
+        int timed_read = timed;
+        reads_seen++;
+        timed = stats && reads_seen % ALIGN_TIMING_SAMPLE == 0;
+        if (opts && opts->progress && (reads_seen >= progress.next_reads || pos >= progress.next_bytes)) {
+            progress_report(opts, &progress, reads_seen, pos, fastq_size, 0);
+        }
+        uint32_t seq_pos = rec.seq_len;
+        if (rec.quality && opts->min_mean_quality &&
+            mean_quality(rec.quality, seq_pos) < opts->min_mean_quality) {
+            if (stats) stats->reads_low_quality++;
+            continue;
+        }
+
         // Align this read
         if (seq_pos >= KMER_SIZE) {
-            ReadAlignment* aln = align_read(index, read_name, sequence, seq_pos);
-            if (aln) {
-                (*results)[*num_results] = aln;
-                (*num_results)++;
+            AlignmentResult best_hit;
+            uint32_t num_kmers = 0;
+            int aligned = 0;
+            uint64_t fingerprint = 0;
+            int cacheable = cache.slots && seq_pos <= READ_CACHE_MAX_LENGTH &&
+                            pack_sequence(sequence, seq_pos, packed);
+
+            if (cacheable) {
+                fingerprint = read_fingerprint(packed, seq_pos);
+                ReadCacheSlot* slot = read_cache_find(&cache, packed, seq_pos, fingerprint);
+                if (stats) stats->cache_lookups++;
+                if (slot) {
+                    if (stats) stats->cache_hits++;
+                    best_hit = slot->result;
+                    num_kmers = slot->num_kmers;
+                    aligned = 1;
+                }
+            }
+
+            if (!aligned) {
+                // The read is long enough, so a failure here means memory ran out
+                if (align_evidence(index, opts, stats, timed_read, sequence, rec.quality, seq_pos,
+                                   NULL, NULL, 0, &best_hit, &num_kmers) < 0) {
+                    ret = -1;
+                    break;
+                }
+                if (cacheable) read_cache_store(&cache, packed, seq_pos, fingerprint, &best_hit, num_kmers);
             }
+
+            count_result(stats, &best_hit);
+            if (summary) {
+                gene_summary_add(summary, &best_hit);
+            } else if (result_buffer_push(&batch, rec.name_start, (uint32_t)(rec.name_end - rec.name_start),
+                                          &best_hit, num_kmers) < 0) {
+                ret = -1;
+                break;
+            }
+            if (++total_results % RESULT_BATCH_ROWS == 0) batch_span_close(&batch_span, RESULT_BATCH_ROWS);
+            if (batch.count == RESULT_BATCH_ROWS) flush_batch(&batch, callback, user_data, stats);
         }
     }
 
+    batch_span_close(&batch_span, total_results % RESULT_BATCH_ROWS);
+    if (ret == 0 && batch.count > 0 && callback) flush_batch(&batch, callback, user_data, stats);
+    trace_end("fastq_chunk", "results", total_results);
+    if (opts && opts->progress && ret == 0) {
+        progress_report(opts, &progress, reads_seen, cancelled ? pos : fastq_size, fastq_size, 1);
+    }
+
     free(sequence);
-    return *num_results;
+    free(quality);
+    free(cache.slots);
+    result_buffer_free(&batch);
+    if (stats) {
+        stats->cancelled = cancelled;
+        stats->total_ns += clock_ns() - start_ns;
+    }
+    return ret < 0 ? -1 : (int)total_results;
+}
+
+// Parse FASTQ and align all reads, handing results to callback in batches of
+// at most RESULT_BATCH_ROWS rows, so memory does not grow with the input.
+// opts and stats may be NULL. Returns the number of aligned reads (-1 if
+// memory runs out); when
+// opts->cancel stops the run early, those are the reads handed to callback
+// so far and stats->cancelled is set.
+int align_fastq_stream(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                       ResultBatchCallback callback, void* user_data, AlignStats* stats) {
+    return align_fastq_reads(index, opts, fastq_data, fastq_size, callback, user_data, NULL, stats);
+}
+
+// Parse FASTQ and align all reads into per-gene totals only (summary must be
+// initialized with gene_summary_init). Returns the number of aligned reads.
+int align_fastq_summary(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                        GeneSummary* summary, AlignStats* stats) {
+    return align_fastq_reads(index, opts, fastq_data, fastq_size, NULL, NULL, summary, stats);
+}
+
+// Mean-quality filter for one mate of a pair: a mate below min_mean_quality
+// contributes no evidence (its length is set to 0)
+static uint32_t mate_length(const FastqRecord* rec, const AlignOptions* opts, AlignStats* stats) {
+    if (rec->quality && opts->min_mean_quality &&
+        mean_quality(rec->quality, rec->seq_len) < opts->min_mean_quality) {
+        if (stats) stats->reads_low_quality++;
+        return 0;
+    }
+    return rec->seq_len;
+}
+
+// Parse R1 and R2 in lockstep (or mates 1 and 2 alternating in r1_data when
+// r2_data is NULL) and align each pair jointly with align_pair. One result
+// per pair, named after R1 without a trailing "/1". Results are folded into
+// summary or batched for callback. Returns the number of aligned pairs, or -1
+// if memory runs out or the mate files hold different numbers of records.
+static int align_fastq_pair_reads(KmerIndex* index, const AlignOptions* opts,
+                                  const char* r1_data, size_t r1_size,
+                                  const char* r2_data, size_t r2_size,
+                                  ResultBatchCallback callback, void* user_data, GeneSummary* summary,
+                                  AlignStats* stats) {
+    int interleaved = r2_data == NULL;
+    if (interleaved) {
+        r2_data = r1_data;
+        r2_size = r1_size;
+    }
+
+    uint64_t start_ns = stats ? clock_ns() : 0;
+    int use_quality = opts && (opts->min_base_quality || opts->min_mean_quality);
+    uint32_t total_results = 0;
+
+    ResultBuffer batch = {0};
+    if (!summary && result_buffer_init(&batch, RESULT_BATCH_ROWS) < 0) return -1;
+    batch.source = r1_data;
+
+    size_t size1 = r1_size < MAX_SEQUENCE_LENGTH ? r1_size + 1 : MAX_SEQUENCE_LENGTH;
+    size_t size2 = r2_size < MAX_SEQUENCE_LENGTH ? r2_size + 1 : MAX_SEQUENCE_LENGTH;
+    char* seq1 = (char*)malloc(size1);
+    char* seq2 = (char*)malloc(size2);
+    char* qual1 = use_quality ? (char*)malloc(size1) : NULL;
+    char* qual2 = use_quality ? (char*)malloc(size2) : NULL;
+    PairScratch scratch;
+    int ret = pair_scratch_init(&scratch, size1, size2, use_quality);
+    if (!seq1 || !seq2 || (use_quality && (!qual1 || !qual2))) ret = -1;
+
+    FastqRecord rec1, rec2;
+    size_t pos1 = 0, pos2 = 0;
+    size_t* mate_pos = interleaved ? &pos1 : &pos2;
+    uint64_t pairs_seen = 0;
+    int timed = stats != NULL;  // The pair being parsed is a timing sample
+    int batch_span = 0;
+    int cancelled = 0;
+    uint64_t total_bytes = (uint64_t)r1_size + (interleaved ? 0 : r2_size);
+    ProgressState progress;
+    if (opts && opts->progress) progress_init(&progress, opts);
+    trace_begin("fastq_chunk", "bytes", total_bytes);
+    while (ret == 0 && !align_cancelled(opts, pairs_seen, &cancelled) &&
+           fastq_next_timed(r1_data, r1_size, &pos1, seq1, qual1, size1, &rec1, timed ? stats : NULL)) {
+        batch_span_open(&batch_span);
+        if (!fastq_next_timed(r2_data, r2_size, mate_pos, seq2, qual2, size2, &rec2, timed ? stats : NULL)) {
+            ret = -1; // R2 ended first
+            break;
+        }
+        int timed_pair = timed;
+        pairs_seen++;
+        timed = stats && pairs_seen % ALIGN_TIMING_SAMPLE == 0;
+        uint64_t bytes = interleaved ? pos1 : (uint64_t)pos1 + pos2;
+        if (opts && opts->progress && (pairs_seen >= progress.next_reads || bytes >= progress.next_bytes)) {
+            progress_report(opts, &progress, pairs_seen, bytes, total_bytes, 0);
+        }
+
+        uint32_t len1 = mate_length(&rec1, opts, stats);
+        uint32_t len2 = mate_length(&rec2, opts, stats);
+        if (len1 < KMER_SIZE && len2 < KMER_SIZE) continue;
+
+        AlignmentResult best_hit;
+        uint32_t num_kmers = 0;
+        if (align_pair_timed(index, seq1, rec1.quality, len1, seq2, rec2.quality, len2, opts, stats,
+                             timed_pair, &scratch, &best_hit, &num_kmers) < 0) {
+            ret = -1;
+            break;
+        }
+        count_result(stats, &best_hit);
+        if (++total_results % RESULT_BATCH_ROWS == 0) batch_span_close(&batch_span, RESULT_BATCH_ROWS);
+
+        if (summary) {
+            gene_summary_add(summary, &best_hit);
+            continue;
+        }
+        size_t name_end = rec1.name_end;
+        if (name_end - rec1.name_start >= 2 && r1_data[name_end - 2] == '/' && r1_data[name_end - 1] == '1') {
+            name_end -= 2;
+        }
+        if (result_buffer_push(&batch, rec1.name_start, (uint32_t)(name_end - rec1.name_start),
+                               &best_hit, num_kmers) < 0) {
+            ret = -1;
+            break;
+        }
+        if (batch.count == RESULT_BATCH_ROWS) flush_batch(&batch, callback, user_data, stats);
+    }
+
+    // R1 ended first
+    if (ret == 0 && !cancelled && !interleaved && fastq_next(r2_data, r2_size, &pos2, seq2, qual2, size2, &rec2)) ret = -1;
+    batch_span_close(&batch_span, total_results % RESULT_BATCH_ROWS);
+    if (ret == 0 && batch.count > 0 && callback) flush_batch(&batch, callback, user_data, stats);
+    trace_end("fastq_chunk", "results", total_results);
+    if (opts && opts->progress && ret == 0) {
+        uint64_t consumed = interleaved ? pos1 : (uint64_t)pos1 + pos2;
+        progress_report(opts, &progress, pairs_seen, cancelled ? consumed : total_bytes, total_bytes, 1);
+    }
+
+    free(seq1);
+    free(seq2);
+    free(qual1);
+    free(qual2);
+    pair_scratch_free(&scratch);
+    result_buffer_free(&batch);
+    if (stats) {
+        stats->cancelled = cancelled;
+        stats->total_ns += clock_ns() - start_ns;
+    }
+    return ret < 0 ? -1 : (int)total_results;
+}
+
+// Paired-end version of align_fastq_stream: one row per pair. r2_data may be
+// NULL for interleaved FASTQ in r1_data.
+int align_fastq_pairs_stream(KmerIndex* index, const AlignOptions* opts,
+                             const char* r1_data, size_t r1_size, const char* r2_data, size_t r2_size,
+                             ResultBatchCallback callback, void* user_data, AlignStats* stats) {
+    return align_fastq_pair_reads(index, opts, r1_data, r1_size, r2_data, r2_size,
+                                  callback, user_data, NULL, stats);
+}
+
+// Paired-end version of align_fastq_summary: each pair counts as one read
+int align_fastq_pairs_summary(KmerIndex* index, const AlignOptions* opts,
+                              const char* r1_data, size_t r1_size, const char* r2_data, size_t r2_size,
+                              GeneSummary* summary, AlignStats* stats) {
+    return align_fastq_pair_reads(index, opts, r1_data, r1_size, r2_data, r2_size,
+                                  NULL, NULL, summary, stats);
+}
+
+// Parse FASTQ and align all reads into results (opts and stats may be NULL).
+// Read names in results point into fastq_data.
+int align_fastq(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                ResultBuffer* results, AlignStats* stats) {
+
+    // Count reads first
+    uint32_t read_count = 0;
+    for (size_t i = 0; i < fastq_size; i++) {
+        if (fastq_data[i] == '@' && (i == 0 || fastq_data[i-1] == '\n')) {
+            read_count++;
+        }
+    }
+
+    if (result_buffer_init(results, read_count) < 0) return -1;
+    results->source = fastq_data;
+
+    ResultCollector collector = {results, 0};
+    int ret = align_fastq_stream(index, opts, fastq_data, fastq_size, result_buffer_collect, &collector, stats);
+    if (ret >= 0 && collector.failed) ret = -1;
+    if (ret < 0) result_buffer_free(results);
+    return ret;
 }
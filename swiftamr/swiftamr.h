@@ -10,9 +10,68 @@
 #define KMER_SIZE 16
 #define MAX_GENE_NAME 256
 #define MAX_SEQUENCE_LENGTH (100 * 1024 * 1024) // 100MB max
-#define HASH_TABLE_SIZE (1 << 24) // 16M entries
+#define HASH_TABLE_MIN_SIZE (1 << 12) // Initial buckets when the k-mer count is unknown
+#define HASH_TABLE_MAX_SIZE (1 << 28) // Upper bound on buckets
+#define HASH_TABLE_MAX_LOAD 1         // Distinct k-mers per bucket before the table doubles
+#define MAX_KMER_STRIDE 64            // Sparsest reference sampling a memory budget may choose
+#define ARENA_BLOCK_SIZE (1 << 20) // 1 MB arena blocks
+#define DUST_WINDOW 64            // Low-complexity masking window (bases)
+#define DUST_THRESHOLD 20.0f      // Triplet score above which a window is masked
+#define PHRED_OFFSET 33           // FASTQ quality encoding (Sanger / Illumina 1.8+)
+#define SEED_EXTEND_MAX_HITS 16   // Seeds with longer hit lists are not extended
+#define HIT_COUNT_OTHER 255       // KmerIndex.hit_counts: base not indexed, but its k-mer is
+#define READ_CACHE_MAX_LENGTH 1024 // Longer reads are never cached
+#define RESULT_BATCH_ROWS 4096     // Rows per batch handed to align_fastq_stream callbacks
+#define OUTPUT_CHUNK_SIZE (64 * 1024) // Streaming writer buffer
+#define RESULT_BINARY_VERSION 1    // Compact binary result format (see results_to_binary)
+#define ALIGN_TIMING_SAMPLE 16     // One read in this many has its phases timed
+#define PROGRESS_INTERVAL_READS 100000     // Default reads between progress callbacks
+#define PROGRESS_INTERVAL_BYTES (16 << 20) // Default FASTQ bytes between progress callbacks
+#define CANCEL_CHECK_READS 4096            // Reads (or pairs) between AlignOptions.cancel polls
+#define PREVIEW_CHUNK_BYTES (1 << 20)      // FASTQ bytes per preview chunk
+#define PREVIEW_MIN_CHUNKS 8               // Chunks aligned before preview convergence is tested
+#define PREVIEW_REL_TOLERANCE 0.1f         // Default: converged when each CI half-width is within 10% of its estimate
+#define PREVIEW_ABS_TOLERANCE 0.0005f      // or within 0.05% of reads, so rare genes do not hold up the stop
+#define PREVIEW_Z 1.96                     // Preview confidence intervals are 95%
+#define TRACE_MAX_EVENTS (1 << 20) // Trace events kept; later spans are dropped and counted
+#define PERF_NUM_EVENTS 5           // Hardware events counted by perf_counters (see PERF_EVENT_NAMES)
+#define DIAG_HISTOGRAM_BINS 32     // Bins of the index_diagnostics histograms
+#define DIAG_TOP_KMERS 20          // Default number of promiscuous k-mers reported
+#define DIAG_TOP_KMER_GENES 16     // Genes listed per promiscuous k-mer
+#define KMER_MASK ((KMER_SIZE) >= 32 ? UINT64_MAX : ((1ULL << (2 * (KMER_SIZE))) - 1))
 
 // Structures
+typedef enum {
+    OUTPUT_FORMAT_TSV = 0,
+    OUTPUT_FORMAT_BINARY = 1,
+    OUTPUT_FORMAT_GENE_SUMMARY = 2,
+    OUTPUT_FORMAT_PREVIEW = 3
+} OutputFormat;
+
+typedef enum {
+    KMER_CAP_DROP = 0,     // Remove k-mers whose hit list exceeds the limit
+    KMER_CAP_TRUNCATE = 1  // Keep only the first max_kmer_hits hits
+} KmerCapMode;
+
+typedef struct {
+    uint32_t max_kmer_hits;  // Hit-list limit per k-mer (0 = unlimited)
+    KmerCapMode cap_mode;    // What to do with k-mers above the limit
+    uint32_t dust_window;    // Low-complexity window (0 = masking disabled)
+    float dust_threshold;    // DUST score above which a window is masked
+    uint32_t kmer_stride;    // Index reference k-mers at every kmer_stride-th position
+    uint64_t expected_kmers; // Initial table sizing hint (0 = start small and grow)
+    uint64_t max_memory;     // Index memory budget in bytes (0 = unlimited); may raise kmer_stride
+} IndexOptions;
+
+typedef struct {
+    uint32_t distinct_kmers;     // K-mers in the hash table after finalize
+    uint64_t masked_bases;       // Reference bases inside low-complexity windows
+    uint64_t masked_kmers;       // K-mers skipped because they overlap masked bases
+    uint32_t capped_kmers;       // K-mers dropped or truncated by max_kmer_hits
+    uint64_t capped_hits;        // Hit-list entries removed by capping
+    uint32_t max_hits_seen;      // Longest hit list before capping
+} IndexStats;
+
 typedef struct {
     uint32_t gene_id;
     uint32_t position;
@@ -26,18 +85,59 @@ typedef struct KmerEntry {
     struct KmerEntry* next; // For hash collision chaining
 } KmerEntry;
 
+// Bump allocator: memory is only released all at once by arena_destroy
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
 typedef struct {
-    char name[MAX_GENE_NAME];
-    char* sequence;
+    ArenaBlock* head;
+    size_t block_size;
+    size_t bytes_allocated;  // Total block bytes obtained from malloc
+} Arena;
+
+typedef struct {
+    uint32_t start;      // First N base, relative to the gene
+    uint32_t length;
+} NRun;
+
+typedef struct {
+    uint32_t name_offset;   // Offset of the NUL-terminated name in KmerIndex.name_pool
+    uint32_t name_length;
+    uint64_t seq_offset;    // First base of the gene in KmerIndex.seq_arena
     uint32_t length;
+    uint32_t n_runs_start;  // This gene's runs of non-ACGT bases in KmerIndex.n_runs
+    uint32_t n_runs_count;
 } Gene;
 
 typedef struct {
     KmerEntry** table;
-    uint32_t table_size;
+    uint32_t table_size;      // Always a power of two
+    uint32_t table_bits;
     Gene* genes;
     uint32_t num_genes;
     uint32_t genes_capacity;
+    char* name_pool;          // Gene names, NUL-terminated, back to back
+    uint32_t name_pool_size;
+    uint32_t name_pool_capacity;
+    uint64_t* seq_arena;      // All gene sequences, 2-bit packed and contiguous
+    uint64_t seq_arena_bases;
+    uint64_t seq_arena_words; // Allocated words (always one spare for packed_window)
+    NRun* n_runs;             // Non-ACGT runs, stored as A in seq_arena
+    uint32_t num_n_runs;
+    uint32_t n_runs_capacity;
+    Arena entry_arena;        // KmerEntry nodes
+    Arena hit_arena;          // Hit lists while the index is being built
+    KmerHit* hit_pool;        // Compacted hit lists after index_finalize
+    uint64_t hit_pool_size;
+    uint8_t* hit_counts;      // Per seq_arena base, for the k-mer starting there: its hit count if
+                              // this occurrence is indexed, 0 if the k-mer is not in the index,
+                              // HIT_COUNT_OTHER otherwise (built by index_finalize)
+    IndexOptions options;
+    IndexStats stats;
+    uint64_t source_hash;     // index_source_hash of the FASTA and options it was built from
 } KmerIndex;
 
 typedef struct {
@@ -45,40 +145,344 @@ typedef struct {
     uint32_t score;        // Number of k-mer hits
     float coverage;        // Fraction of gene covered
     float identity;        // Estimated identity
+    uint32_t start;        // Span of the gene covered by the read's k-mers
+    uint32_t end;
+    uint32_t ties;         // Other genes with the same best score
 } AlignmentResult;
 
+// Where a running alignment is, handed to AlignOptions.progress
+typedef struct {
+    uint64_t reads;          // Records (pairs when paired) parsed so far
+    uint64_t bytes;          // FASTQ bytes consumed
+    uint64_t total_bytes;    // FASTQ bytes of the whole call
+    double seconds;          // Since the call started
+    double reads_per_sec;
+    int done;                // Last callback of the call
+} AlignProgress;
+
+typedef void (*ProgressCallback)(const AlignProgress* progress, void* user_data);
+
+// Polled every CANCEL_CHECK_READS reads; nonzero stops the alignment
+typedef int (*CancelCallback)(void* user_data);
+
+typedef struct {
+    uint8_t min_base_quality;  // Skip k-mers overlapping bases below this Phred (0 = off)
+    uint8_t min_mean_quality;  // Skip reads whose mean Phred is below this (0 = off)
+    uint32_t read_cache_entries; // Exact-duplicate read cache slots (0 = off)
+    int seed_extend;           // Extend seed hits against packed genes instead of looking up every k-mer
+    ProgressCallback progress; // Called every progress_reads reads or progress_bytes bytes, and at the end (NULL = off)
+    void* progress_user_data;
+    uint32_t progress_reads;   // 0 = no read interval
+    uint64_t progress_bytes;   // 0 = no byte interval
+    CancelCallback cancel;     // Stop early when this returns nonzero, keeping the results so far (NULL = off)
+    void* cancel_user_data;
+} AlignOptions;
+
 typedef struct {
-    char* read_name;
-    AlignmentResult best_hit;
-    uint32_t num_kmers_in_read;
-} ReadAlignment;
+    uint64_t reads_low_quality;  // Reads skipped by min_mean_quality
+    uint64_t kmers_low_quality;  // K-mers skipped by min_base_quality
+    uint64_t cache_lookups;      // Reads looked up in the duplicate-read cache
+    uint64_t cache_hits;         // Reads answered from the cache
+    uint64_t kmers_extended;     // K-mers credited by seed extension instead of a lookup
+    uint64_t reads_tied;         // Aligned reads whose best score was shared by another gene
+    int cancelled;               // opts->cancel stopped the alignment; results cover the reads before that
+    // Hot-path counters
+    uint64_t reads_aligned;      // Reads (or pairs) that produced a result
+    uint64_t reads_no_hit;       // Of those, reads without a best hit
+    uint64_t kmers_extracted;    // K-mers looked up or credited by extension
+    uint64_t lookups;            // Hash table lookups
+    uint64_t lookup_hits;        // Lookups that found the k-mer
+    uint64_t hits_visited;       // Hit-list entries scored after a lookup hit
+    uint64_t chain_probes;       // Entries compared while walking bucket chains
+    // Phase times in ns. parse, lookup (k-mer extraction, lookups and hit
+    // scoring) and score (winner and coverage) are estimated from one read in
+    // ALIGN_TIMING_SAMPLE; output (batch callbacks) and total are measured.
+    uint64_t parse_ns;
+    uint64_t lookup_ns;
+    uint64_t score_ns;
+    uint64_t output_ns;
+    uint64_t total_ns;
+} AlignStats;
+
+// Columnar per-read results. Read names are not copied: each row stores the
+// offset and length of the name inside the FASTQ buffer it was parsed from,
+// which must outlive the results.
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* gene_id;       // UINT32_MAX = no hit
+    uint32_t* score;
+    float* coverage;
+    float* identity;
+    uint32_t* kmers;         // K-mers extracted from the read
+    uint64_t* name_offset;   // Read name position in source
+    uint32_t* name_length;
+    const char* source;      // FASTQ buffer the names point into
+} ResultBuffer;
+
+// Per-gene totals for summary mode: align_fastq_summary folds each read into
+// these accumulators instead of keeping a result row per read
+typedef struct {
+    uint32_t num_genes;
+    uint64_t reads_total;     // Reads aligned, with or without a hit
+    uint64_t reads_mapped;    // Reads with a best hit
+    uint64_t* read_counts;    // Reads won by each gene
+    uint64_t* score_sums;     // Sum of the winning scores
+    uint64_t* aligned_bases;  // Sum of read span lengths, for mean depth
+    uint64_t* covered;        // One bit per gene base; each gene starts on a new word
+    uint64_t* covered_offset; // First covered word of each gene
+} GeneSummary;
+
+// Why preview_fastq stopped
+typedef enum {
+    PREVIEW_STOP_END = 0,        // Every chunk was aligned
+    PREVIEW_STOP_CONVERGED = 1,  // Every gene's interval is within tolerance
+    PREVIEW_STOP_TIME = 2,       // max_seconds reached
+    PREVIEW_STOP_READS = 3,      // max_reads reached
+    PREVIEW_STOP_CANCELLED = 4   // AlignOptions.cancel fired
+} PreviewStop;
+
+typedef struct {
+    double max_seconds;      // Time budget (0 = none)
+    uint64_t max_reads;      // Read budget (0 = none)
+    float rel_tolerance;     // Converged when every CI half-width is within this fraction of its estimate
+    float abs_tolerance;     // or within this fraction of all reads
+    uint32_t min_chunks;     // Chunks aligned before convergence is tested
+    uint32_t chunk_bytes;    // FASTQ bytes per chunk
+    uint64_t seed;           // Chunk order
+} PreviewOptions;
+
+// Running per-gene abundance of preview_fastq: each gene's share of the
+// sampled reads, with a confidence interval from the spread between chunks
+typedef struct {
+    uint32_t num_genes;
+    uint32_t num_chunks;     // Chunks in the file
+    uint32_t chunks_done;
+    uint64_t bytes_total;
+    uint64_t bytes_done;     // FASTQ bytes of the chunks aligned
+    uint64_t reads_done;     // Reads aligned, with or without a hit
+    double seconds;
+    PreviewStop stop;
+    double* abundance;       // Fraction of reads won by each gene
+    double* ci_half;         // Half-width of its PREVIEW_Z interval
+    // Sums over chunks of x (a gene's reads in the chunk) and n (the chunk's reads)
+    uint64_t* last_counts;   // Gene read counts after the previous chunk
+    double* sum_x2;
+    double* sum_xn;
+    double sum_n2;
+} GenePreview;
+
+// One FASTQ record parsed by fastq_next. The name is a range of the FASTQ
+// buffer; quality is NULL when not kept or when its length does not match.
+typedef struct {
+    size_t name_start;
+    size_t name_end;
+    uint32_t seq_len;
+    const char* quality;
+} FastqRecord;
+
+// A k-mer with one of the longest hit lists
+typedef struct {
+    const KmerEntry* entry;
+    uint32_t num_genes;       // Distinct genes in the hit list
+} PromiscuousKmer;
+
+// Index structure report from index_diagnostics, for tuning table sizing and
+// masking per database
+typedef struct {
+    uint32_t table_size;
+    uint64_t distinct_kmers;     // Entries reachable from the table
+    uint64_t used_buckets;       // Buckets with at least one entry
+    uint32_t longest_chain;
+    double load_factor;          // Entries per bucket; also the mean probes of a missing k-mer
+    double mean_probes_found;    // Chain entries compared by a lookup that finds its k-mer
+    uint64_t chain_histogram[DIAG_HISTOGRAM_BINS]; // Buckets by chain length; the last bin holds longer chains
+    uint64_t hits_histogram[DIAG_HISTOGRAM_BINS];  // K-mers by hit-list length; bin b holds [2^b, 2^(b+1))
+    uint64_t total_hits;
+    uint32_t longest_hit_list;
+    uint64_t single_gene_kmers;  // K-mers whose hits all lie in one gene
+    PromiscuousKmer* top;        // Longest hit lists first
+    uint32_t num_top;
+    uint32_t* gene_kmers;        // Hit-list entries per gene
+    uint32_t* gene_unique_kmers; // K-mers found in that gene only
+    // Bytes held by each component
+    uint64_t table_bytes;
+    uint64_t entry_bytes;
+    uint64_t hit_bytes;
+    uint64_t sequence_bytes;  // Packed bases and their hit counts
+    uint64_t n_run_bytes;
+    uint64_t gene_bytes;
+    uint64_t name_bytes;
+} IndexDiagnostics;
+
+// perf_event file descriptors, one per event in PERF_EVENT_NAMES (-1 = not available)
+typedef struct {
+    int fds[PERF_NUM_EVENTS];
+} PerfCounters;
+
+// Called with each full batch of results (and the final partial one);
+// the batch is reused after the callback returns
+typedef void (*ResultBatchCallback)(const ResultBuffer* batch, void* user_data);
+
+// result_buffer_collect's state: rows are appended to results, and failed is
+// set once a row could not be
+typedef struct {
+    ResultBuffer* results;
+    int failed;
+} ResultCollector;
+
+// Receives formatted output chunks; data is only valid during the call
+typedef void (*OutputCallback)(const char* data, size_t size, void* user_data);
+
+// Streaming TSV writer: rows are formatted into a fixed chunk buffer that is
+// handed to the callback whenever it fills
+typedef struct {
+    char buffer[OUTPUT_CHUNK_SIZE];
+    size_t used;
+    uint64_t bytes_written;
+    OutputCallback callback;
+    void* user_data;
+} TsvWriter;
+
+// Key-value storage for serialized indexes (index_io.c). Both functions
+// return 0 on success and -1 on failure or a missing key; read hands back
+// a malloc'd buffer that the caller frees.
+typedef struct {
+    int (*read)(void* user_data, const char* key, uint8_t** data, size_t* size);
+    int (*write)(void* user_data, const char* key, const uint8_t* data, size_t size);
+    void* user_data;
+} IndexStorage;
 
 // Function declarations
 
+// Arena allocation
+void arena_init(Arena* arena, size_t block_size);
+void* arena_alloc(Arena* arena, size_t size);
+void arena_destroy(Arena* arena);
+
 // Index building
-KmerIndex* index_create(void);
+void index_options_default(IndexOptions* opts);
+KmerIndex* index_create(const IndexOptions* opts);
 void index_destroy(KmerIndex* index);
 int index_add_gene(KmerIndex* index, const char* name, const char* sequence);
 int index_build_from_fasta(KmerIndex* index, const char* fasta_data, size_t fasta_size);
+const char* index_gene_name(const KmerIndex* index, uint32_t gene_id);
+int index_gene_base(const KmerIndex* index, uint32_t gene_id, uint32_t pos);
 void index_finalize(KmerIndex* index);
+int index_resize_table(KmerIndex* index, uint32_t table_size);
+uint64_t index_estimate_memory(uint64_t num_bases, uint32_t num_genes, uint32_t kmer_stride);
+uint64_t index_source_hash(const IndexOptions* opts, const char* fasta_data, size_t fasta_size);
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
 
 // K-mer operations
 uint64_t kmer_encode(const char* seq);
 int kmer_is_valid(const char* seq);
-void kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32_t position);
+int kmer_add_to_index(KmerIndex* index, uint64_t kmer, uint32_t gene_id, uint32_t position);
 KmerEntry* kmer_lookup(KmerIndex* index, uint64_t kmer);
+void reverse_complement(const char* seq, const char* qual, uint32_t len, char* out, char* out_qual);
 
 // Alignment
-ReadAlignment* align_read(KmerIndex* index, const char* read_name, const char* sequence, uint32_t seq_len);
-void alignment_destroy(ReadAlignment* aln);
-int align_fastq(KmerIndex* index, const char* fastq_data, size_t fastq_size,
-                ReadAlignment*** results, uint32_t* num_results);
+void align_options_default(AlignOptions* opts);
+int align_read(KmerIndex* index, const char* sequence, const char* quality, uint32_t seq_len,
+               const AlignOptions* opts, AlignStats* stats,
+               AlignmentResult* best_hit, uint32_t* num_kmers);
+int align_pair(KmerIndex* index, const char* seq1, const char* qual1, uint32_t len1,
+               const char* seq2, const char* qual2, uint32_t len2,
+               const AlignOptions* opts, AlignStats* stats,
+               AlignmentResult* best_hit, uint32_t* num_kmers);
+int align_fastq(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                ResultBuffer* results, AlignStats* stats);
+int align_fastq_stream(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                       ResultBatchCallback callback, void* user_data, AlignStats* stats);
+int align_fastq_summary(KmerIndex* index, const AlignOptions* opts, const char* fastq_data, size_t fastq_size,
+                        GeneSummary* summary, AlignStats* stats);
+int align_fastq_pairs_stream(KmerIndex* index, const AlignOptions* opts,
+                             const char* r1_data, size_t r1_size, const char* r2_data, size_t r2_size,
+                             ResultBatchCallback callback, void* user_data, AlignStats* stats);
+int align_fastq_pairs_summary(KmerIndex* index, const AlignOptions* opts,
+                              const char* r1_data, size_t r1_size, const char* r2_data, size_t r2_size,
+                              GeneSummary* summary, AlignStats* stats);
+
+// FASTQ parsing
+int fastq_next(const char* fastq_data, size_t fastq_size, size_t* pos,
+               char* sequence, char* quality, size_t buffer_size, FastqRecord* rec);
+
+// Gene summaries
+int gene_summary_init(GeneSummary* summary, const KmerIndex* index);
+void gene_summary_add(GeneSummary* summary, const AlignmentResult* best_hit);
+uint64_t gene_summary_covered_bases(const GeneSummary* summary, uint32_t gene_id);
+void gene_summary_free(GeneSummary* summary);
+
+// Preview (preview.c)
+void preview_options_default(PreviewOptions* opts);
+int preview_fastq(KmerIndex* index, const AlignOptions* align_opts, const PreviewOptions* opts,
+                  const char* fastq_data, size_t fastq_size, GeneSummary* summary,
+                  GenePreview* preview, AlignStats* stats);
+const char* preview_stop_reason(PreviewStop stop);
+int preview_describe(const GenePreview* preview, char* out, size_t size);
+void gene_preview_free(GenePreview* preview);
 
-// Serialization (for pre-built index)
+// Result buffers
+int result_buffer_init(ResultBuffer* results, uint32_t capacity);
+int result_buffer_push(ResultBuffer* results, uint64_t name_offset, uint32_t name_length,
+                       const AlignmentResult* best_hit, uint32_t num_kmers);
+void result_buffer_free(ResultBuffer* results);
+void result_buffer_collect(const ResultBuffer* batch, void* user_data);
+
+// 2-bit packing (first base in the high bits of each 64-bit word)
+#define PACKED_WORDS(len) (((len) + 31) / 32)
+int pack_sequence(const char* seq, uint32_t len, uint64_t* packed);
+
+// Output (output.c)
+void tsv_writer_init(TsvWriter* writer, OutputCallback callback, void* user_data);
+void tsv_writer_write(TsvWriter* writer, const char* data, size_t size);
+void tsv_writer_header(TsvWriter* writer);
+void tsv_writer_rows(TsvWriter* writer, const ResultBuffer* batch, const KmerIndex* index);
+void tsv_writer_gene_summary(TsvWriter* writer, const GeneSummary* summary, const KmerIndex* index);
+void tsv_writer_gene_preview(TsvWriter* writer, const GenePreview* preview, const GeneSummary* summary,
+                             const KmerIndex* index);
+void tsv_writer_flush(TsvWriter* writer);
+uint8_t* results_to_binary(const ResultBuffer* results, const KmerIndex* index, size_t* size);
+char* format_uint(char* out, uint64_t value);
+char* format_fixed4(char* out, float value);
+
+// Serialization (for pre-built index, index_io.c)
+uint8_t* index_serialize(const KmerIndex* index, size_t* size);
+KmerIndex* index_deserialize(const uint8_t* data, size_t size);
 int index_save(KmerIndex* index, const char* filename);
 KmerIndex* index_load(const char* filename);
 
+// Index cache, keyed by index_source_hash
+void index_cache_key(uint64_t source_hash, char* key, size_t key_size);
+KmerIndex* index_cache_load(const IndexStorage* storage, uint64_t source_hash);
+int index_cache_store(const IndexStorage* storage, const KmerIndex* index);
+void index_storage_directory(IndexStorage* storage, const char* dir);
+
+// Tracing (trace.c): begin/end spans of pipeline phases, exported as Chrome
+// trace-event JSON. Spans are no-ops until trace_start.
+void trace_start(void);
+void trace_stop(void);
+int trace_active(void);
+void trace_clear(void);
+void trace_begin(const char* name, const char* arg_name, uint64_t arg);
+void trace_end(const char* name, const char* arg_name, uint64_t arg);
+char* trace_json(size_t* size);
+
+// Hardware counters (perf_counters.c): cycles, instructions, LLC, dTLB and
+// branch misses of the calling thread. Linux native builds only; elsewhere
+// perf_counters_open finds no events.
+extern const char* const PERF_EVENT_NAMES[PERF_NUM_EVENTS];
+int perf_counters_open(PerfCounters* perf);
+void perf_counters_start(PerfCounters* perf);
+void perf_counters_stop(PerfCounters* perf, uint64_t values[PERF_NUM_EVENTS]);
+void perf_counters_close(PerfCounters* perf);
+
+// Index diagnostics (index_diag.c)
+int index_diagnostics(const KmerIndex* index, uint32_t top_n, IndexDiagnostics* diag);
+void index_diagnostics_free(IndexDiagnostics* diag);
+
 // Utility
-void print_alignment(ReadAlignment* aln, const KmerIndex* index);
+void print_alignment(const ResultBuffer* results, uint32_t row, const KmerIndex* index);
+uint64_t clock_ns(void);
 
 #endif // SWIFTAMR_H
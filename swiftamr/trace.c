@@ -0,0 +1,133 @@
+#include "swiftamr.h"
+
+// Chrome trace-event recorder. Spans are recorded as begin/end pairs in
+// memory and rendered by trace_json, which Perfetto and chrome://tracing load
+// directly. The engine is single-threaded, so every event is on one thread.
+
+typedef struct {
+    const char* name;      // Static strings, rendered at export
+    const char* arg_name;  // NULL = no args
+    uint64_t arg;
+    uint64_t ts_ns;        // Since trace_start
+    char phase;            // 'B' or 'E'
+} TraceEvent;
+
+static TraceEvent* trace_events = NULL;
+static uint32_t trace_count = 0;
+static uint32_t trace_capacity = 0;
+static uint64_t trace_origin_ns = 0;
+static int trace_recording = 0;
+static uint32_t trace_open = 0;          // Recorded spans not yet ended
+static uint32_t trace_dropped_open = 0;  // Dropped spans not yet ended
+static uint64_t trace_dropped = 0;       // Events dropped at TRACE_MAX_EVENTS
+
+static int trace_push(const char* name, char phase, const char* arg_name, uint64_t arg) {
+    if (trace_count == trace_capacity) {
+        uint32_t capacity = trace_capacity ? trace_capacity * 2 : 4096;
+        if (capacity > TRACE_MAX_EVENTS) capacity = TRACE_MAX_EVENTS;
+        TraceEvent* grown = (TraceEvent*)realloc(trace_events, capacity * sizeof(TraceEvent));
+        if (!grown) return -1;
+        trace_events = grown;
+        trace_capacity = capacity;
+    }
+    TraceEvent* ev = &trace_events[trace_count++];
+    ev->name = name;
+    ev->arg_name = arg_name;
+    ev->arg = arg;
+    ev->ts_ns = clock_ns() - trace_origin_ns;
+    ev->phase = phase;
+    return 0;
+}
+
+// Discard any recorded events and start recording
+void trace_start(void) {
+    trace_clear();
+    trace_origin_ns = clock_ns();
+    trace_recording = 1;
+}
+
+// Stop recording, closing any open spans; recorded events stay available
+// to trace_json
+void trace_stop(void) {
+    if (!trace_recording) return;
+    for (; trace_open; trace_open--) trace_push("", 'E', NULL, 0);
+    trace_dropped_open = 0;
+    trace_recording = 0;
+}
+
+int trace_active(void) {
+    return trace_recording;
+}
+
+void trace_clear(void) {
+    free(trace_events);
+    trace_events = NULL;
+    trace_count = trace_capacity = 0;
+    trace_open = trace_dropped_open = 0;
+    trace_dropped = 0;
+}
+
+// Open a span (name must be a static string). Spans nest and are closed in
+// reverse order. Once TRACE_MAX_EVENTS is near, new spans are dropped but
+// room is kept to close the recorded ones, so the trace stays balanced.
+void trace_begin(const char* name, const char* arg_name, uint64_t arg) {
+    if (!trace_recording) return;
+    if (trace_dropped_open || (uint64_t)trace_count + trace_open + 2 > TRACE_MAX_EVENTS ||
+        trace_push(name, 'B', arg_name, arg) < 0) {
+        trace_dropped_open++;
+        trace_dropped++;
+        return;
+    }
+    trace_open++;
+}
+
+// Close the innermost open span; arg (if arg_name is set) is merged into its args
+void trace_end(const char* name, const char* arg_name, uint64_t arg) {
+    if (!trace_recording) return;
+    if (trace_dropped_open) {
+        trace_dropped_open--;
+        trace_dropped++;
+        return;
+    }
+    if (!trace_open) return;
+    trace_open--;
+    // Room for this event was reserved by trace_begin
+    trace_push(name, 'E', arg_name, arg);
+}
+
+// Recorded events as a Chrome trace-event JSON object. Returns a malloc'd
+// NUL-terminated string (size excludes the NUL) or NULL.
+char* trace_json(size_t* size) {
+    // Longest event: fixed text, two names, two 20-digit numbers
+    size_t capacity = 256 + (size_t)trace_count * 160;
+    char* json = (char*)malloc(capacity);
+    if (!json) return NULL;
+
+    size_t used = (size_t)snprintf(json, capacity,
+        "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%llu},\"traceEvents\":["
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"swiftamr\"}},"
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"engine\"}}",
+        (unsigned long long)trace_dropped);
+    for (uint32_t i = 0; i < trace_count && used < capacity; i++) {
+        const TraceEvent* ev = &trace_events[i];
+        used += (size_t)snprintf(json + used, capacity - used,
+                                 ",{\"name\":\"%s\",\"cat\":\"swiftamr\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                                 "\"pid\":1,\"tid\":1",
+                                 ev->name, ev->phase, (unsigned long long)(ev->ts_ns / 1000),
+                                 (unsigned)(ev->ts_ns % 1000));
+        if (ev->arg_name && used < capacity) {
+            used += (size_t)snprintf(json + used, capacity - used, ",\"args\":{\"%s\":%llu}",
+                                     ev->arg_name, (unsigned long long)ev->arg);
+        }
+        if (used < capacity) json[used++] = '}';
+    }
+    if (used + 3 > capacity) {
+        free(json);
+        return NULL;
+    }
+    json[used++] = ']';
+    json[used++] = '}';
+    json[used] = '\0';
+    if (size) *size = used;
+    return json;
+}